@@ -0,0 +1,267 @@
+/** Runs Lox programs through `interpret()`, and prints how they performed as
+ * JSON, so runs can be compared across commits:
+ *
+ *     bazel run -c opt //bench > results.json
+ *     bazel run -c opt //bench -- --registers --repetitions=10
+ *
+ * Every repetition runs in a fresh process, so it starts from an empty heap,
+ * and its peak RSS is its own. The instructions are the CPU's, counted by
+ * perf, and are null where perf isn't available.
+ */
+#include "src/debug_flags.h"
+#include "src/vm/vm.h"
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+constexpr int DEFAULT_REPETITIONS = 5;
+
+/** What a repetition sends back to the runner. */
+struct Measurement {
+    double seconds;
+    // -1 if they couldn't be counted.
+    int64_t instructions;
+    InterpretResult result;
+};
+
+struct Benchmark {
+    std::string name;
+    std::vector<double> seconds;
+    std::optional<int64_t> instructions;
+    long peak_rss_kb = 0;
+    InterpretResult result = InterpretResult::OK;
+};
+
+/** A counter of the instructions this process runs in user space, or -1. */
+int open_instruction_counter() {
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+/** Run `source` in this process, which must be a child of the runner. */
+Measurement measure(const std::string &source, ExecutionTier tier) {
+    // The program's output would mix with the results.
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    VM vm{InterpretMode::FILE, tier};
+    int counter = open_instruction_counter();
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    auto start = std::chrono::steady_clock::now();
+    InterpretResult result = interpret(vm, source);
+    auto end = std::chrono::steady_clock::now();
+
+    int64_t instructions = -1;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &instructions, sizeof(instructions)) !=
+            sizeof(instructions)) {
+            instructions = -1;
+        }
+        close(counter);
+    }
+    return {std::chrono::duration<double>(end - start).count(), instructions,
+            result};
+}
+
+/** Run one repetition of `benchmark` in a child process. Returns false if the
+ * child died.
+ */
+bool repeat(Benchmark &benchmark, const std::string &source,
+            ExecutionTier tier) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+        return false;
+    }
+    std::cout.flush();
+    pid_t child = fork();
+    if (child < 0) {
+        return false;
+    }
+    if (child == 0) {
+        close(pipe_fds[0]);
+        Measurement measurement = measure(source, tier);
+        ssize_t written =
+            write(pipe_fds[1], &measurement, sizeof(measurement));
+        _exit(written == sizeof(measurement) ? 0 : 1);
+    }
+
+    close(pipe_fds[1]);
+    Measurement measurement;
+    ssize_t received = read(pipe_fds[0], &measurement, sizeof(measurement));
+    close(pipe_fds[0]);
+    int status;
+    rusage usage;
+    if (wait4(child, &status, 0, &usage) != child or
+        received != sizeof(measurement) or !WIFEXITED(status) or
+        WEXITSTATUS(status) != 0) {
+        return false;
+    }
+
+    // Keep the instructions of the fastest repetition.
+    if (benchmark.seconds.empty() or
+        measurement.seconds < *std::ranges::min_element(benchmark.seconds)) {
+        if (measurement.instructions >= 0) {
+            benchmark.instructions = measurement.instructions;
+        } else {
+            benchmark.instructions.reset();
+        }
+    }
+    benchmark.seconds.push_back(measurement.seconds);
+    // In kilobytes on Linux.
+    benchmark.peak_rss_kb = std::max(benchmark.peak_rss_kb, usage.ru_maxrss);
+    benchmark.result = measurement.result;
+    return true;
+}
+
+std::string_view result_name(InterpretResult result) {
+    switch (result) {
+    case InterpretResult::OK:
+        return "ok";
+    case InterpretResult::COMPILE_ERROR:
+        return "compile_error";
+    case InterpretResult::RUNTIME_ERROR:
+        return "runtime_error";
+    }
+    return "unknown";
+}
+
+std::string to_json(const std::vector<Benchmark> &benchmarks,
+                    ExecutionTier tier, int repetitions) {
+    std::time_t now = std::time(nullptr);
+    char date[32];
+    std::strftime(date, sizeof(date), "%FT%TZ", std::gmtime(&now));
+    std::string json = fmt::format(
+        "{{\n"
+        "  \"context\": {{\"date\": \"{}\", \"tier\": \"{}\", "
+        "\"repetitions\": {}, \"debug_build\": {}}},\n"
+        "  \"benchmarks\": [",
+        date, tier == ExecutionTier::STACK ? "stack" : "registers",
+        repetitions, DEBUG_BUILD);
+
+    const char *separator = "\n";
+    for (const Benchmark &benchmark : benchmarks) {
+        std::vector<double> seconds = benchmark.seconds;
+        std::ranges::sort(seconds);
+        double min = seconds.front();
+        double median = seconds[seconds.size() / 2];
+        double mean = std::accumulate(seconds.begin(), seconds.end(), 0.0) /
+                      seconds.size();
+        std::string instructions = "null";
+        std::string instructions_per_second = "null";
+        if (benchmark.instructions.has_value()) {
+            instructions = std::to_string(benchmark.instructions.value());
+            instructions_per_second =
+                fmt::format("{:.0f}", benchmark.instructions.value() / min);
+        }
+        json += fmt::format(
+            "{}    {{\"name\": \"{}\", \"result\": \"{}\", "
+            "\"wall_seconds\": {{\"min\": {:.6f}, \"median\": {:.6f}, "
+            "\"mean\": {:.6f}}}, \"instructions\": {}, "
+            "\"instructions_per_second\": {}, \"peak_rss_kb\": {}}}",
+            separator, benchmark.name, result_name(benchmark.result), min,
+            median, mean, instructions, instructions_per_second,
+            benchmark.peak_rss_kb);
+        separator = ",\n";
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+int usage() {
+    std::cerr << "Usage: bench [--registers] [--repetitions=<n>] "
+                 "program.lox...\n";
+    return 1;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    ExecutionTier tier = ExecutionTier::STACK;
+    int repetitions = DEFAULT_REPETITIONS;
+    std::vector<std::filesystem::path> programs;
+    constexpr std::string_view REPETITIONS = "--repetitions=";
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--registers") {
+            tier = ExecutionTier::REGISTER;
+        } else if (arg.starts_with(REPETITIONS)) {
+            std::string_view count = arg.substr(REPETITIONS.size());
+            auto [end, error] = std::from_chars(
+                count.data(), count.data() + count.size(), repetitions);
+            if (error != std::errc() or end != count.data() + count.size() or
+                repetitions < 1) {
+                return usage();
+            }
+        } else if (arg.starts_with("--")) {
+            return usage();
+        } else {
+            programs.emplace_back(arg);
+        }
+    }
+    if (programs.empty()) {
+        return usage();
+    }
+    if constexpr (DEBUG_BUILD) {
+        std::cerr << "Warning: debug flags are on, build with -c opt.\n";
+    }
+
+    std::vector<Benchmark> benchmarks;
+    bool failed = false;
+    for (const std::filesystem::path &program : programs) {
+        std::ifstream ifs(program);
+        if (!ifs) {
+            std::cerr << "Could not open '" << program.string() << "'.\n";
+            return 74;
+        }
+        std::string source(std::istreambuf_iterator<char>(ifs), {});
+        Benchmark &benchmark = benchmarks.emplace_back();
+        benchmark.name = program.stem().string();
+        for (int i = 0; i < repetitions; ++i) {
+            if (!repeat(benchmark, source, tier)) {
+                std::cerr << "Running '" << benchmark.name << "' failed.\n";
+                return 70;
+            }
+        }
+        failed |= benchmark.result != InterpretResult::OK;
+        std::cerr << fmt::format(
+            "{:<20} {:>10.3f} ms {:>10} KB\n", benchmark.name,
+            *std::ranges::min_element(benchmark.seconds) * 1000,
+            benchmark.peak_rss_kb);
+    }
+    std::cout << to_json(benchmarks, tier, repetitions);
+    return failed ? 1 : 0;
+}
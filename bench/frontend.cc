@@ -0,0 +1,197 @@
+/** Throughput of the front end: the scanner, the parser and the compiler,
+ * over synthetic sources from 1KB to 50MB.
+ *
+ *     bazel run -c opt //bench:frontend -- --benchmark_format=json
+ *
+ * Every benchmark reports tokens and bytes per second, and the calls to
+ * `operator new` per KB of source.
+ */
+#include "src/syntactics/parser.h"
+#include "src/syntactics/scanner.h"
+#include "src/vm/vm.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <new>
+#include <string>
+
+namespace {
+
+size_t allocations = 0;
+
+enum Kind : int64_t {
+    MANY_FUNCTIONS,
+    LONG_EXPRESSIONS,
+    DEEP_NESTING,
+    STRING_LITERALS,
+};
+
+// Functions are named cyclically, since there are at most 65536 globals.
+constexpr int FUNCTION_NAMES = 1000;
+
+/** The `index`th unit of a source of `kind`: a function declaration. */
+std::string unit(Kind kind, int index) {
+    std::string name = "f" + std::to_string(index % FUNCTION_NAMES);
+    switch (kind) {
+    case MANY_FUNCTIONS:
+        return "fun " + name +
+               "(a, b) {\n"
+               "    var c = a + b;\n"
+               "    if (c > 10) return c * 2;\n"
+               "    return " +
+               name + "(c, b - 1);\n}\n";
+    case LONG_EXPRESSIONS: {
+        std::string source = "fun " + name + "(x) {\n    return x";
+        for (int i = 0; i < 200; ++i) {
+            source += i % 3 == 0 ? " + " : i % 3 == 1 ? " * " : " - ";
+            source += i % 5 == 0 ? "(x / " + std::to_string(i + 1) + ")"
+                                 : std::to_string(i * 7 % 101);
+        }
+        return source + ";\n}\n";
+    }
+    case DEEP_NESTING: {
+        constexpr int DEPTH = 40;
+        std::string source = "fun " + name + "(x) {\n";
+        for (int i = 0; i < DEPTH; ++i) {
+            source += "if (x > " + std::to_string(i) + ") { ";
+        }
+        source += "return ((((((x))))));";
+        for (int i = 0; i < DEPTH; ++i) {
+            source += " }";
+        }
+        return source + "\n    return nil;\n}\n";
+    }
+    case STRING_LITERALS: {
+        std::string source = "fun " + name + "() {\n";
+        for (int i = 0; i < 20; ++i) {
+            source += "    print \"literal " + std::to_string(index) + "." +
+                      std::to_string(i) + " of a long running script\";\n";
+        }
+        return source + "}\n";
+    }
+    }
+    return "";
+}
+
+/** A source of `kind`, of at least `bytes` bytes. Only the last one is
+ * kept, since the largest take 50MB each.
+ */
+const std::string &source(Kind kind, size_t bytes) {
+    static Kind cached_kind;
+    static size_t cached_bytes = 0;
+    static std::string cached;
+    if (cached_bytes != bytes or cached_kind != kind) {
+        cached.clear();
+        cached.reserve(bytes + 4096);
+        for (int i = 0; cached.size() < bytes; ++i) {
+            cached += unit(kind, i);
+        }
+        cached_kind = kind;
+        cached_bytes = bytes;
+    }
+    return cached;
+}
+
+size_t count_tokens(const std::string &text) {
+    Scanner scanner{text};
+    size_t tokens = 0;
+    while (scanner.scan_token().type != TokenType::END_OF_FILE) {
+        ++tokens;
+    }
+    return tokens;
+}
+
+/** Report the counters shared by every benchmark. `allocated` is the number
+ * of allocations of all iterations.
+ */
+void report(benchmark::State &state, const std::string &text,
+            size_t allocated) {
+    size_t tokens = count_tokens(text);
+    state.SetBytesProcessed(state.iterations() * text.size());
+    state.counters["tokens_per_second"] = benchmark::Counter(
+        static_cast<double>(tokens * state.iterations()),
+        benchmark::Counter::kIsRate);
+    state.counters["allocations_per_kb"] =
+        static_cast<double>(allocated) / state.iterations() /
+        (text.size() / 1024.0);
+}
+
+void BM_Scanner(benchmark::State &state) {
+    const std::string &text =
+        source(static_cast<Kind>(state.range(0)), state.range(1));
+    size_t before = allocations;
+    for (auto _ : state) {
+        Scanner scanner{text};
+        while (true) {
+            Token token = scanner.scan_token();
+            benchmark::DoNotOptimize(token);
+            if (token.type == TokenType::END_OF_FILE) {
+                break;
+            }
+        }
+    }
+    report(state, text, allocations - before);
+}
+
+void BM_Parser(benchmark::State &state) {
+    const std::string &text =
+        source(static_cast<Kind>(state.range(0)), state.range(1));
+    size_t before = allocations;
+    for (auto _ : state) {
+        Parser parser{text};
+        do {
+            parser.advance();
+            benchmark::DoNotOptimize(parser.current);
+        } while (parser.current.type != TokenType::END_OF_FILE);
+    }
+    report(state, text, allocations - before);
+}
+
+void BM_Compiler(benchmark::State &state) {
+    const std::string &text =
+        source(static_cast<Kind>(state.range(0)), state.range(1));
+    VM vm{InterpretMode::FILE};
+    size_t before = allocations;
+    for (auto _ : state) {
+        auto script = compile(vm, text);
+        if (!script.has_value()) {
+            state.SkipWithError("The source doesn't compile.");
+            break;
+        }
+        benchmark::DoNotOptimize(script);
+    }
+    report(state, text, allocations - before);
+}
+
+void sizes(benchmark::internal::Benchmark *benchmark) {
+    benchmark->ArgNames({"kind", "bytes"});
+    benchmark->ArgsProduct({
+        {MANY_FUNCTIONS, LONG_EXPRESSIONS, DEEP_NESTING, STRING_LITERALS},
+        {1 << 10, 64 << 10, 1 << 20, 50 << 20},
+    });
+    benchmark->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+BENCHMARK(BM_Scanner)->Apply(sizes);
+BENCHMARK(BM_Parser)->Apply(sizes);
+BENCHMARK(BM_Compiler)->Apply(sizes);
+
+// Count every allocation, including the heap's.
+void *operator new(std::size_t size) {
+    ++allocations;
+    if (void *memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+BENCHMARK_MAIN();
@@ -1,5 +1,6 @@
 #include "compiler.h"
 
+#include "src/compiler/peephole.h"
 #include "src/debug_flags.h"
 #include "src/vm/debug.h"
 #include <algorithm>
@@ -12,7 +13,6 @@
 extern constinit ParseRule rules[];
 
 constexpr auto CONST_REF_T_MAX = std::numeric_limits<const_ref_t>::max();
-constexpr auto JUMP_OFF_T_MAX = std::numeric_limits<jump_off_t>::max();
 
 Precedence operator+(Precedence precedence, int other) {
     return static_cast<Precedence>(static_cast<int>(precedence) + other);
@@ -22,14 +22,21 @@ Token empty_token() { return {TokenType::END_OF_FILE, "", 0}; }
 
 Local empty_local() { return {empty_token(), 0}; }
 
-Compiler::Compiler(HeapManager &heap_manager, Parser &parser, FunctionType type,
-                   Compiler *enclosing)
-    : heap_manager(heap_manager), parser(parser), locals({empty_local()}),
+Compiler::Compiler(HeapManager &heap_manager, Globals &globals, Parser &parser,
+                   FunctionType type, Compiler *enclosing)
+    : heap_manager(heap_manager), globals(globals), parser(parser),
+      locals({empty_local()}),
       scope_depth(0), compiling_function(type == FunctionType::SCRIPT
                                              ? heap_manager.new_function()
                                              : heap_manager.new_function(
                                                    parser.previous.lexeme)),
-      type(type), enclosing(enclosing), upvalues() {}
+      type(type), enclosing(enclosing), upvalues(), operand_start(0),
+      call_end(-1) {
+    // The function isn't reachable from the VM until compilation is done.
+    heap_manager.push_root(compiling_function);
+}
+
+Compiler::~Compiler() { heap_manager.pop_root(); }
 
 std::optional<heap_ptr<ObjFunction>> Compiler::compile() {
     parser.advance();
@@ -94,7 +101,7 @@ void Compiler::function(FunctionType type) {
         std::string("Can't have more than ") + std::to_string(CONST_REF_T_MAX) +
         " parameters.";
 
-    Compiler compiler{heap_manager, parser, type, this};
+    Compiler compiler{heap_manager, globals, parser, type, this};
     compiler.begin_scope();
 
     parser.consume(TokenType::LEFT_PAREN, "Expect '(' after function name.");
@@ -104,7 +111,7 @@ void Compiler::function(FunctionType type) {
             if (compiler.compiling_function->arity > CONST_REF_T_MAX) {
                 parser.error_at_current(error_message);
             }
-            const_ref_t constant =
+            global_ref_t constant =
                 compiler.parse_variable("Expect parameter name.");
             compiler.define_variable(constant);
         } while (parser.match(TokenType::COMMA));
@@ -117,7 +124,7 @@ void Compiler::function(FunctionType type) {
     compiler.end_scope();
     auto function = compiler.end_compilation();
     // TODO: If closure is not needed, emit function.
-    emit(OpCode::CLOSURE, make_constant(function));
+    emit_with_constant(OpCode::CLOSURE, make_constant(function));
     for (const auto &upvalue : compiler.upvalues) {
         emit(upvalue.is_local ? 1 : 0, upvalue.index);
     }
@@ -224,14 +231,21 @@ void Compiler::return_statement() {
     if (parser.match(TokenType::SEMICOLON)) {
         emit_return();
     } else {
+        int start = current_chunk().code.size();
         expression();
         parser.consume(TokenType::SEMICOLON, "Expect ';' after return value.");
+        // A call that the expression ends with is in tail position, even if
+        // a jump (e.g. of `and`) skips it: the jump still lands on RETURN.
+        int end = current_chunk().code.size();
+        if (call_end > start and call_end == end) {
+            current_chunk().code[end - 2].opcode = OpCode::TAIL_CALL;
+        }
         emit(OpCode::RETURN);
     }
 }
 
 void Compiler::var_declaration() {
-    const_ref_t global = parse_variable("Expect variable name.");
+    global_ref_t global = parse_variable("Expect variable name.");
 
     if (parser.match(TokenType::EQUAL)) {
         expression();
@@ -245,7 +259,7 @@ void Compiler::var_declaration() {
 }
 
 void Compiler::fun_declaration() {
-    const_ref_t global = parse_variable("Expect function name.");
+    global_ref_t global = parse_variable("Expect function name.");
     // Functions can be used
     mark_initialized_last();
 
@@ -258,7 +272,7 @@ void Compiler::begin_scope() { scope_depth++; }
 void Compiler::end_scope() {
     scope_depth--;
 
-    // TODO: add OpCode::POPN to pop many times.
+    // Runs of POPs are fused into POPN by the peephole optimizer.
     while (locals.size() > 0 and locals.back().depth > scope_depth) {
         if (locals.back().is_captured) {
             emit(OpCode::CLOSE_UPVALUE);
@@ -283,10 +297,23 @@ void Compiler::grouping(bool can_assign) {
 
 void Compiler::unary(bool can_assign) {
     TokenType operator_type = parser.previous.type;
+    int start = current_chunk().code.size();
 
     // Compile operand.
     parse_precedence(Precedence::UNARY);
 
+    if (auto operand = constant_at(start, current_chunk().code.size())) {
+        if (operator_type == TokenType::BANG) {
+            replace_with_constant(start, !static_cast<bool>(*operand));
+            return;
+        }
+        // Negating anything else is a runtime error.
+        if (operator_type == TokenType::MINUS and operand->is_number()) {
+            replace_with_constant(start, -operand->as_number());
+            return;
+        }
+    }
+
     // Emit operator instruction.
     switch (operator_type) {
     case TokenType::MINUS:
@@ -302,9 +329,20 @@ void Compiler::unary(bool can_assign) {
 
 void Compiler::binary(bool can_assign) {
     TokenType operator_type = parser.previous.type;
+    int lhs_start = operand_start;
+    int rhs_start = current_chunk().code.size();
     ParseRule &rule = get_rule(operator_type);
     parse_precedence(rule.precedence + 1);
 
+    auto lhs = constant_at(lhs_start, rhs_start);
+    auto rhs = constant_at(rhs_start, current_chunk().code.size());
+    if (lhs and rhs) {
+        if (auto result = fold_binary(operator_type, *lhs, *rhs)) {
+            replace_with_constant(lhs_start, *result);
+            return;
+        }
+    }
+
     switch (operator_type) {
     case TokenType::BANG_EQUAL:
         emit(OpCode::EQUAL, OpCode::NOT);
@@ -386,6 +424,7 @@ void Compiler::or_(bool can_assign) {
 void Compiler::call(bool can_assign) {
     const_ref_t arg_count = argument_list();
     emit(OpCode::CALL, arg_count);
+    call_end = current_chunk().code.size();
 }
 
 void Compiler::declare_variable() {
@@ -409,7 +448,7 @@ void Compiler::declare_variable() {
     add_local(name);
 }
 
-const_ref_t Compiler::parse_variable(const std::string &error_message) {
+global_ref_t Compiler::parse_variable(const std::string &error_message) {
     parser.consume(TokenType::IDENTIFIER, error_message);
 
     declare_variable();
@@ -417,16 +456,16 @@ const_ref_t Compiler::parse_variable(const std::string &error_message) {
         return 0;
     }
 
-    return identifier_constant(parser.previous);
+    return global_slot(parser.previous);
 }
 
-void Compiler::define_variable(const_ref_t global) {
+void Compiler::define_variable(global_ref_t global) {
     if (scope_depth > 0) {
         mark_initialized_last();
         // Local variables live on the stack.
         return;
     }
-    emit(OpCode::DEFINE_GLOBAL, global);
+    emit_global(OpCode::DEFINE_GLOBAL, global);
 }
 
 void Compiler::add_local(const Token &name) {
@@ -443,6 +482,9 @@ Chunk &Compiler::current_chunk() { return compiling_function->chunk; }
 heap_ptr<ObjFunction> Compiler::end_compilation() {
     emit(OpCode::NIL);
     emit_return();
+    if (!parser.had_error()) {
+        optimize_peephole(current_chunk());
+    }
     if constexpr (DEBUG_PRINT_CODE) {
         if (!parser.had_error()) {
             disassemble_chunk(current_chunk(),
@@ -459,54 +501,179 @@ heap_ptr<ObjFunction> Compiler::end_compilation() {
 void Compiler::emit_return() { emit(OpCode::RETURN); }
 
 void Compiler::emit_constant(const Value &value) {
-    emit(OpCode::CONSTANT, make_constant(value));
+    emit_with_constant(OpCode::CONSTANT, make_constant(value));
+}
+
+void Compiler::emit_with_constant(OpCode instruction, wide_ref_t constant) {
+    if (constant <= CONST_REF_T_MAX) {
+        emit(instruction, static_cast<const_ref_t>(constant));
+        return;
+    }
+    emit(OpCode::WIDE, instruction);
+    int offset = current_chunk().code.size();
+    for (size_t i = 0; i < sizeof(wide_ref_t); ++i) {
+        emit(0xff);
+    }
+    current_chunk().wide_at(offset) = constant;
 }
 
 int Compiler::emit_jump(OpCode instruction) {
-    emit(instruction);
+    emit(OpCode::WIDE, instruction);
     // Empty for now, to be patched
     return emit_jump_value();
 }
 
-int Compiler::emit_jump_value(jump_off_t value) {
+int Compiler::emit_jump_value(wide_ref_t value) {
     int jump_offset = emit_jump_value();
     // We might be able to write it without initializing-then-setting, but
     // whatever.
-    current_chunk().jump_at(jump_offset) = value;
+    current_chunk().wide_at(jump_offset) = value;
     return jump_offset;
 }
 
 int Compiler::emit_jump_value() {
     int offset = current_chunk().code.size();
-    for (size_t i = 0; i < sizeof(jump_off_t); ++i) {
+    for (size_t i = 0; i < sizeof(wide_ref_t); ++i) {
         emit(0xff);
     }
     return offset;
 }
 
 void Compiler::emit_loop(int loop_start) {
-    emit(OpCode::LOOP);
-    int offset = current_chunk().code.size() - loop_start + sizeof(jump_off_t);
-    if (offset > JUMP_OFF_T_MAX) {
-        parser.error("Loop body too large.");
-    }
-
+    emit(OpCode::WIDE, OpCode::LOOP);
+    int offset =
+        current_chunk().code.size() - loop_start + sizeof(wide_ref_t);
     emit_jump_value(offset);
 }
 
-const_ref_t Compiler::make_constant(const Value &value) {
-    int constant_ref = current_chunk().add_constant(value);
-    if (constant_ref > CONST_REF_T_MAX) {
-        // Not really a parser error, but we use the parser for bookkeeping
-        // errors.
-        parser.error("Too many constants in one chunk.");
-        return 0;
+void Compiler::emit_global(OpCode instruction, global_ref_t global) {
+    emit(instruction);
+    int offset = current_chunk().code.size();
+    for (size_t i = 0; i < sizeof(global_ref_t); ++i) {
+        emit(0xff);
     }
+    current_chunk().global_at(offset) = global;
+}
+
+wide_ref_t Compiler::make_constant(const Value &value) {
+    int constant_ref = current_chunk().add_constant(value);
+    heap_manager.get_heap().write_barrier(compiling_function.get(), value);
     return constant_ref;
 }
 
-const_ref_t Compiler::identifier_constant(const Token &name) {
-    return make_constant(heap_manager.initialize(name.lexeme));
+std::optional<Value> Compiler::constant_at(int start, int end) {
+    const Chunk &chunk = current_chunk();
+    if (start >= end) {
+        return std::nullopt;
+    }
+    switch (chunk.code[start].opcode) {
+    case OpCode::CONSTANT:
+        if (end - start != 2) {
+            return std::nullopt;
+        }
+        return chunk.constants[chunk.code[start + 1].constant_ref];
+    case OpCode::WIDE:
+        if (end - start != 2 + sizeof(wide_ref_t) or
+            chunk.code[start + 1].opcode != OpCode::CONSTANT) {
+            return std::nullopt;
+        }
+        return chunk.constants[chunk.wide_at(start + 2)];
+    case OpCode::NIL:
+        return end - start == 1 ? std::optional<Value>(Value()) : std::nullopt;
+    case OpCode::TRUE:
+        return end - start == 1 ? std::optional<Value>(true) : std::nullopt;
+    case OpCode::FALSE:
+        return end - start == 1 ? std::optional<Value>(false) : std::nullopt;
+    default:
+        return std::nullopt;
+    }
+}
+
+void Compiler::replace_with_constant(int start, const Value &value) {
+    Chunk &chunk = current_chunk();
+    // Only constant instructions are folded, so code[start:] is a sequence of
+    // them. Drop their constants, unless something was added to the pool
+    // after them.
+    std::vector<wide_ref_t> folded;
+    for (int offset = start; offset < static_cast<int>(chunk.code.size());) {
+        if (chunk.code[offset].opcode == OpCode::CONSTANT) {
+            folded.push_back(chunk.code[offset + 1].constant_ref);
+            offset += 2;
+        } else if (chunk.code[offset].opcode == OpCode::WIDE) {
+            folded.push_back(chunk.wide_at(offset + 2));
+            offset += 2 + sizeof(wide_ref_t);
+        } else {
+            offset += 1;
+        }
+    }
+    for (auto constant = folded.rbegin(); constant != folded.rend();
+         ++constant) {
+        if (size_t{*constant} + 1 == chunk.constants.size()) {
+            chunk.constants.pop_back();
+        }
+    }
+    chunk.truncate(start);
+
+    if (value.is_nil()) {
+        emit(OpCode::NIL);
+    } else if (value.is_bool()) {
+        emit(value.as_bool() ? OpCode::TRUE : OpCode::FALSE);
+    } else {
+        emit_constant(value);
+    }
+}
+
+std::optional<Value> Compiler::fold_binary(TokenType operator_type,
+                                           const Value &a, const Value &b) {
+    // Equality never fails, whatever the operand types.
+    switch (operator_type) {
+    case TokenType::EQUAL_EQUAL:
+        return a == b;
+    case TokenType::BANG_EQUAL:
+        return !(a == b);
+    default:
+        break;
+    }
+
+    if (operator_type == TokenType::PLUS and a.is_string() and b.is_string()) {
+        return heap_manager.concatenate(a.as_string(), b.as_string());
+    }
+
+    if (!a.is_number() or !b.is_number()) {
+        return std::nullopt;
+    }
+    double x = a.as_number();
+    double y = b.as_number();
+    // Mirror the instructions `binary` would emit, e.g. `>=` is `!(x < y)`.
+    switch (operator_type) {
+    case TokenType::GREATER:
+        return x > y;
+    case TokenType::GREATER_EQUAL:
+        return !(x < y);
+    case TokenType::LESS:
+        return x < y;
+    case TokenType::LESS_EQUAL:
+        return !(x > y);
+    case TokenType::PLUS:
+        return x + y;
+    case TokenType::MINUS:
+        return x - y;
+    case TokenType::STAR:
+        return x * y;
+    case TokenType::SLASH:
+        return x / y;
+    default:
+        return std::nullopt;
+    }
+}
+
+global_ref_t Compiler::global_slot(const Token &name) {
+    auto slot = globals.resolve(heap_manager.initialize(name.lexeme));
+    if (!slot) {
+        parser.error("Too many global variables.");
+        return 0;
+    }
+    return slot.value();
 }
 
 std::optional<const_ref_t> Compiler::resolve_local(const Token &name) {
@@ -573,9 +740,14 @@ void Compiler::named_variable(const Token &name, bool can_assign) {
         get_op = OpCode::GET_UPVALUE;
         set_op = OpCode::SET_UPVALUE;
     } else {
-        arg = identifier_constant(name);
-        get_op = OpCode::GET_GLOBAL;
-        set_op = OpCode::SET_GLOBAL;
+        global_ref_t global = global_slot(name);
+        if (can_assign and parser.match(TokenType::EQUAL)) {
+            expression();
+            emit_global(OpCode::SET_GLOBAL, global);
+        } else {
+            emit_global(OpCode::GET_GLOBAL, global);
+        }
+        return;
     }
 
     if (can_assign and parser.match(TokenType::EQUAL)) {
@@ -614,13 +786,8 @@ size_t Compiler::argument_list() {
 
 void Compiler::patch_jump(int offset) {
     // the minus to adjust for the bytecode for the jump offset itself.
-    int jump = current_chunk().code.size() - offset - sizeof(jump_off_t);
-
-    if (jump > JUMP_OFF_T_MAX) {
-        parser.error("Too much code to jump over.");
-    }
-
-    current_chunk().jump_at(offset) = jump;
+    int jump = current_chunk().code.size() - offset - sizeof(wide_ref_t);
+    current_chunk().wide_at(offset) = jump;
 }
 
 void Compiler::parse_precedence(Precedence precedence) {
@@ -633,11 +800,13 @@ void Compiler::parse_precedence(Precedence precedence) {
     }
 
     bool can_assign = precedence <= Precedence::ASSIGNMENT;
+    int start = current_chunk().code.size();
     std::invoke(prefix_rule, this, can_assign);
 
     while (precedence <= get_rule(parser.current.type).precedence) {
         parser.advance();
         ParseFn infix_rule = get_rule(parser.previous.type).infix;
+        operand_start = start;
         std::invoke(infix_rule, this, can_assign);
     }
 
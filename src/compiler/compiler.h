@@ -2,6 +2,7 @@
 
 #include "src/syntactics/parser.h"
 #include "src/vm/chunk.h"
+#include "src/vm/globals.h"
 #include "src/vm/heap_manager.h"
 #include "src/vm/obj_function.h"
 #include "src/vm/value.h"
@@ -52,10 +53,12 @@ struct Upvalue {
 enum struct FunctionType { FUNCTION, SCRIPT };
 
 struct Compiler {
-    Compiler(HeapManager &heap_manager, Parser &parser,
+    Compiler(HeapManager &heap_manager, Globals &globals, Parser &parser,
              FunctionType type = FunctionType::SCRIPT,
              Compiler *enclosing = nullptr);
 
+    ~Compiler();
+
     std::optional<heap_ptr<ObjFunction>> compile();
 
     // Expressions. These are public for the `rules` table.
@@ -93,8 +96,8 @@ struct Compiler {
     void end_scope();
 
     void declare_variable();
-    const_ref_t parse_variable(const std::string &error_message);
-    void define_variable(const_ref_t global);
+    global_ref_t parse_variable(const std::string &error_message);
+    void define_variable(global_ref_t global);
     void add_local(const Token &name);
 
     Chunk &current_chunk();
@@ -109,15 +112,37 @@ struct Compiler {
 
     void emit_return();
     void emit_constant(const Value &value);
+    /** Emit `instruction` with a constant operand, in the wide form if the
+     * constant doesn't fit in a `const_ref_t`.
+     */
+    void emit_with_constant(OpCode instruction, wide_ref_t constant);
+    /** Jumps are always emitted in the wide form, as the distance of a forward
+     * jump is not known yet. The peephole pass makes the ones that fit
+     * compact.
+     */
     int emit_jump(OpCode instruction);
     /** returns index of jump value. */
-    int emit_jump_value(jump_off_t value);
+    int emit_jump_value(wide_ref_t value);
     // Empty jump
     int emit_jump_value();
     void emit_loop(int loop_start);
-
-    const_ref_t make_constant(const Value &value);
-    const_ref_t identifier_constant(const Token &name);
+    void emit_global(OpCode instruction, global_ref_t global);
+
+    wide_ref_t make_constant(const Value &value);
+
+    // Constant folding
+    /** The value of code[start:end], if it is exactly one instruction pushing
+     * a constant.
+     */
+    std::optional<Value> constant_at(int start, int end);
+    /** Replace code[start:] with an instruction pushing `value`. */
+    void replace_with_constant(int start, const Value &value);
+    /** The result of `a <op> b`, unless it must be computed at runtime (e.g.
+     * because it raises an error).
+     */
+    std::optional<Value> fold_binary(TokenType operator_type, const Value &a,
+                                     const Value &b);
+    global_ref_t global_slot(const Token &name);
     std::optional<const_ref_t> resolve_local(const Token &name);
     std::optional<const_ref_t> resolve_upvalue(const Token &name);
 
@@ -135,6 +160,7 @@ struct Compiler {
     void parse_precedence(Precedence precedence);
 
     HeapManager &heap_manager;
+    Globals &globals;
     Parser &parser;
     std::vector<Local> locals;
     int scope_depth;
@@ -142,6 +168,11 @@ struct Compiler {
     FunctionType type;
     Compiler *const enclosing;
     std::vector<Upvalue> upvalues;
+    // Where the left operand of the infix rule being parsed starts.
+    int operand_start;
+    // Offset just past the last CALL emitted, which a return statement turns
+    // into a tail call if it ends there.
+    int call_end;
 };
 
 struct ParseRule {
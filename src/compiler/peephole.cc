@@ -0,0 +1,341 @@
+#include "peephole.h"
+
+#include "src/vm/obj_function.h"
+
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace {
+
+struct Instruction {
+    OpCode opcode;
+    int offset;
+    int line;
+    // Operand bytes, except jump offsets.
+    std::vector<InstructionData> operands;
+    // Absolute offset of the jump target, for jumps.
+    std::optional<int> target;
+    // Whether `operands` start with a wide constant. Jumps are made wide when
+    // re-encoded, if their offset needs it.
+    bool wide = false;
+};
+
+bool is_jump(OpCode opcode) {
+    switch (opcode) {
+    case OpCode::JUMP:
+    case OpCode::JUMP_IF_FALSE:
+    case OpCode::JUMP_IF_TRUE:
+    case OpCode::LOOP:
+    case OpCode::JUMP_IF_FALSE_POP:
+    case OpCode::JUMP_IF_NOT_LESS:
+    case OpCode::JUMP_IF_NOT_GREATER:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::vector<Instruction> decode(Chunk &chunk) {
+    std::vector<Instruction> instructions;
+    for (int offset = 0; offset < static_cast<int>(chunk.code.size());) {
+        bool wide = chunk.code[offset].opcode == OpCode::WIDE;
+        int operands = offset + (wide ? 2 : 1);
+        OpCode opcode = chunk.code[operands - 1].opcode;
+        int size = instruction_size(chunk, offset);
+        Instruction instruction{opcode, offset, chunk.get_line(offset), {}, {}};
+        if (is_jump(opcode)) {
+            int jump = wide ? chunk.wide_at(operands) : chunk.jump_at(operands);
+            int next = offset + size;
+            instruction.target =
+                opcode == OpCode::LOOP ? next - jump : next + jump;
+        } else {
+            instruction.operands.assign(chunk.code.begin() + operands,
+                                        chunk.code.begin() + offset + size);
+            instruction.wide = wide;
+        }
+        instructions.push_back(std::move(instruction));
+        offset += size;
+    }
+    return instructions;
+}
+
+struct Peephole {
+    Peephole(Chunk &chunk)
+        : chunk(chunk), input(decode(chunk)),
+          index_of(chunk.code.size() + 1, -1), incoming(chunk.code.size() + 1),
+          removed(input.size(), false) {
+        for (size_t i = 0; i < input.size(); ++i) {
+            index_of[input[i].offset] = i;
+        }
+        index_of[chunk.code.size()] = input.size();
+        for (const auto &instruction : input) {
+            if (instruction.target) {
+                ++incoming[*instruction.target];
+            }
+        }
+    }
+
+    void run() {
+        // Old offset -> index in `output` of the instruction that replaced it.
+        std::vector<int> output_index(chunk.code.size() + 1, -1);
+        for (size_t i = 0; i < input.size();) {
+            output_index[input[i].offset] = output.size();
+            if (removed[i]) {
+                ++i;
+                continue;
+            }
+            i += fuse(i);
+        }
+        output_index[chunk.code.size()] = output.size();
+        // Removed instructions are only ever jumped over, but map them to
+        // their successor anyway.
+        for (int offset = chunk.code.size() - 1; offset >= 0; --offset) {
+            if (output_index[offset] == -1) {
+                output_index[offset] = output_index[offset + 1];
+            }
+        }
+
+        // Lay the code out with compact jumps, then widen the jumps that
+        // don't fit until none are left. Widening only moves targets further
+        // away, so this terminates.
+        std::vector<int> new_offsets;
+        bool widened = true;
+        while (widened) {
+            new_offsets.clear();
+            int offset = 0;
+            for (const auto &instruction : output) {
+                new_offsets.push_back(offset);
+                offset += encoded_size(instruction);
+            }
+            new_offsets.push_back(offset);
+
+            widened = false;
+            for (size_t i = 0; i < output.size(); ++i) {
+                Instruction &instruction = output[i];
+                if (instruction.target and !instruction.wide and
+                    jump_distance(i, new_offsets, output_index) >
+                        std::numeric_limits<jump_off_t>::max()) {
+                    instruction.wide = true;
+                    widened = true;
+                }
+            }
+        }
+
+        CodeChunk code;
+        for (size_t i = 0; i < output.size(); ++i) {
+            const Instruction &instruction = output[i];
+            if (instruction.wide) {
+                code.write(OpCode::WIDE, instruction.line);
+            }
+            code.write(instruction.opcode, instruction.line);
+            if (!instruction.target) {
+                for (auto operand : instruction.operands) {
+                    code.write(operand, instruction.line);
+                }
+                continue;
+            }
+            int jump_offset = code.code.size();
+            int jump_size =
+                instruction.wide ? sizeof(wide_ref_t) : sizeof(jump_off_t);
+            for (int j = 0; j < jump_size; ++j) {
+                code.write(0xff, instruction.line);
+            }
+            int jump = jump_distance(i, new_offsets, output_index);
+            if (instruction.wide) {
+                code.wide_at(jump_offset) = jump;
+            } else {
+                code.jump_at(jump_offset) = jump;
+            }
+        }
+        static_cast<CodeChunk &>(chunk) = std::move(code);
+    }
+
+  private:
+    static int encoded_size(const Instruction &instruction) {
+        int size = instruction.wide ? 2 : 1;
+        if (!instruction.target) {
+            return size + instruction.operands.size();
+        }
+        return size +
+               (instruction.wide ? sizeof(wide_ref_t) : sizeof(jump_off_t));
+    }
+
+    /** The jump operand of output[i] in the layout given by `new_offsets`. */
+    int jump_distance(size_t i, const std::vector<int> &new_offsets,
+                      const std::vector<int> &output_index) const {
+        int next = new_offsets[i + 1];
+        int target = new_offsets[output_index[*output[i].target]];
+        return output[i].opcode == OpCode::LOOP ? next - target
+                                                : target - next;
+    }
+
+    /** Whether instructions [i+1, i+count) exist and are not jumped to, so
+     * they can be fused with instruction i.
+     */
+    bool fusable(size_t i, size_t count) const {
+        if (i + count > input.size()) {
+            return false;
+        }
+        for (size_t j = i + 1; j < i + count; ++j) {
+            if (incoming[input[j].offset] > 0 or removed[j]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is(size_t i, OpCode opcode) const {
+        return i < input.size() and input[i].opcode == opcode;
+    }
+
+    /** If instruction i is `JUMP_IF_FALSE` to a `POP` that can only be reached
+     * by that jump, and is followed by a `POP`, return the index of the
+     * target `POP`.
+     */
+    std::optional<size_t> jump_if_false_pop(size_t i) const {
+        if (!is(i, OpCode::JUMP_IF_FALSE) or !is(i + 1, OpCode::POP) or
+            !fusable(i, 2)) {
+            return std::nullopt;
+        }
+        int target = *input[i].target;
+        if (incoming[target] != 1) {
+            return std::nullopt;
+        }
+        int target_index = index_of[target];
+        if (target_index <= 0 or !is(target_index, OpCode::POP)) {
+            return std::nullopt;
+        }
+        // The target must not be reachable by falling through.
+        OpCode before = input[target_index - 1].opcode;
+        if (before != OpCode::JUMP and before != OpCode::LOOP) {
+            return std::nullopt;
+        }
+        return target_index;
+    }
+
+    /** Emit the instruction(s) starting at input[i], returning how many input
+     * instructions were consumed.
+     */
+    size_t fuse(size_t i) {
+        const Instruction &first = input[i];
+
+        // Compare-and-branch: `LESS JUMP_IF_FALSE POP` and `GREATER ...`.
+        if ((is(i, OpCode::LESS) or is(i, OpCode::GREATER)) and fusable(i, 2)) {
+            if (auto pop = jump_if_false_pop(i + 1)) {
+                removed[*pop] = true;
+                emit(first.opcode == OpCode::LESS ? OpCode::JUMP_IF_NOT_LESS
+                                                  : OpCode::JUMP_IF_NOT_GREATER,
+                     first, {}, input[*pop].offset + 1);
+                return 3;
+            }
+        }
+
+        if (auto pop = jump_if_false_pop(i)) {
+            removed[*pop] = true;
+            emit(OpCode::JUMP_IF_FALSE_POP, first, {}, input[*pop].offset + 1);
+            return 2;
+        }
+
+        if (is(i, OpCode::GET_LOCAL) and is(i + 1, OpCode::CONSTANT) and
+            !input[i + 1].wide and is(i + 2, OpCode::ADD) and fusable(i, 3)) {
+            emit(OpCode::ADD_LOCAL_CONST, first,
+                 {first.operands[0], input[i + 1].operands[0]});
+            return 3;
+        }
+
+        if (is(i + 1, OpCode::NOT) and fusable(i, 2)) {
+            switch (first.opcode) {
+            case OpCode::EQUAL:
+                emit(OpCode::NOT_EQUAL, first);
+                return 2;
+            case OpCode::LESS:
+                emit(OpCode::GREATER_EQUAL, first);
+                return 2;
+            case OpCode::GREATER:
+                emit(OpCode::LESS_EQUAL, first);
+                return 2;
+            default:
+                break;
+            }
+        }
+
+        if (first.opcode == OpCode::POP) {
+            size_t count = 1;
+            while (count < std::numeric_limits<const_ref_t>::max() and
+                   is(i + count, OpCode::POP) and fusable(i, count + 1)) {
+                ++count;
+            }
+            if (count > 1) {
+                emit(OpCode::POPN, first, {static_cast<const_ref_t>(count)});
+                return count;
+            }
+        }
+
+        output.push_back(first);
+        return 1;
+    }
+
+    void emit(OpCode opcode, const Instruction &first,
+              std::vector<InstructionData> operands = {},
+              std::optional<int> target = std::nullopt) {
+        output.push_back({opcode, first.offset, first.line,
+                          std::move(operands), target, false});
+    }
+
+    Chunk &chunk;
+    std::vector<Instruction> input;
+    // Offset -> index in `input`, for offsets where an instruction starts.
+    std::vector<int> index_of;
+    // Number of jumps to every offset.
+    std::vector<int> incoming;
+    // Instructions made unreachable by an earlier fusion.
+    std::vector<bool> removed;
+    std::vector<Instruction> output;
+};
+
+} // namespace
+
+int instruction_size(const Chunk &chunk, int offset) {
+    if (chunk.code[offset].opcode == OpCode::WIDE) {
+        if (chunk.code[offset + 1].opcode != OpCode::CLOSURE) {
+            return 2 + sizeof(wide_ref_t);
+        }
+        wide_ref_t constant = chunk.wide_at(offset + 2);
+        return 2 + sizeof(wide_ref_t) +
+               2 * chunk.constants[constant].as_function()->upvalue_count;
+    }
+    switch (chunk.code[offset].opcode) {
+    case OpCode::CONSTANT:
+    case OpCode::GET_LOCAL:
+    case OpCode::SET_LOCAL:
+    case OpCode::GET_UPVALUE:
+    case OpCode::SET_UPVALUE:
+    case OpCode::CALL:
+    case OpCode::TAIL_CALL:
+    case OpCode::POPN:
+        return 2;
+    case OpCode::DEFINE_GLOBAL:
+    case OpCode::GET_GLOBAL:
+    case OpCode::SET_GLOBAL:
+        return 1 + sizeof(global_ref_t);
+    case OpCode::JUMP:
+    case OpCode::JUMP_IF_FALSE:
+    case OpCode::JUMP_IF_TRUE:
+    case OpCode::LOOP:
+    case OpCode::JUMP_IF_FALSE_POP:
+    case OpCode::JUMP_IF_NOT_LESS:
+    case OpCode::JUMP_IF_NOT_GREATER:
+        return 1 + sizeof(jump_off_t);
+    case OpCode::ADD_LOCAL_CONST:
+        return 3;
+    case OpCode::CLOSURE: {
+        const_ref_t constant = chunk.code[offset + 1].constant_ref;
+        return 2 + 2 * chunk.constants[constant].as_function()->upvalue_count;
+    }
+    default:
+        return 1;
+    }
+}
+
+void optimize_peephole(Chunk &chunk) { Peephole(chunk).run(); }
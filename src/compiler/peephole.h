@@ -0,0 +1,13 @@
+#pragma once
+
+#include "src/vm/chunk.h"
+
+/** Number of bytes taken by the instruction at `offset`, operands included. */
+int instruction_size(const Chunk &chunk, int offset);
+
+/** Rewrite `chunk` to fuse common instruction sequences into
+ * superinstructions, e.g. `EQUAL NOT` into `NOT_EQUAL`. Jump offsets and line
+ * numbers are kept consistent with the new code, and every jump is re-encoded
+ * in the compact form if its new distance fits, or `WIDE` otherwise.
+ */
+void optimize_peephole(Chunk &chunk);
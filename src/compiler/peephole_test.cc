@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include "src/compiler/peephole.h"
+#include "src/vm/chunk.h"
+
+#include <vector>
+
+void write_jump(Chunk &chunk, OpCode opcode, jump_off_t jump, int line) {
+    chunk.write(opcode, line);
+    int offset = chunk.code.size();
+    chunk.write(0xff, line);
+    chunk.write(0xff, line);
+    chunk.jump_at(offset) = jump;
+}
+
+std::vector<OpCode> opcodes(const Chunk &chunk) {
+    std::vector<OpCode> result;
+    for (int offset = 0; offset < static_cast<int>(chunk.code.size());
+         offset += instruction_size(chunk, offset)) {
+        result.push_back(chunk.code[offset].opcode);
+    }
+    return result;
+}
+
+TEST(PeepholeTests, TestFuseNegatedComparisons) {
+    Chunk chunk;
+    chunk.write(OpCode::TRUE, 1);
+    chunk.write(OpCode::FALSE, 1);
+    chunk.write(OpCode::EQUAL, 2);
+    chunk.write(OpCode::NOT, 2);
+    chunk.write(OpCode::POP, 3);
+    chunk.write(OpCode::POP, 3);
+    chunk.write(OpCode::POP, 4);
+    chunk.write(OpCode::RETURN, 5);
+
+    optimize_peephole(chunk);
+    EXPECT_EQ(opcodes(chunk),
+              (std::vector<OpCode>{OpCode::TRUE, OpCode::FALSE,
+                                   OpCode::NOT_EQUAL, OpCode::POPN,
+                                   OpCode::RETURN}));
+    EXPECT_EQ(chunk.code[4].constant_ref, 3);
+    EXPECT_EQ(chunk.get_line(2), 2);
+    EXPECT_EQ(chunk.get_line(3), 3);
+    EXPECT_EQ(chunk.get_line(5), 5);
+}
+
+TEST(PeepholeTests, TestFuseLoop) {
+    // while (i < 10) i = i + 1;
+    Chunk chunk;
+    int ten = chunk.add_constant(10.0);
+    int one = chunk.add_constant(1.0);
+    chunk.write(OpCode::GET_LOCAL, 1);
+    chunk.write(1, 1);
+    chunk.write(OpCode::CONSTANT, 1);
+    chunk.write(ten, 1);
+    chunk.write(OpCode::LESS, 1);
+    write_jump(chunk, OpCode::JUMP_IF_FALSE, 12, 1);
+    chunk.write(OpCode::POP, 1);
+    chunk.write(OpCode::GET_LOCAL, 2);
+    chunk.write(1, 2);
+    chunk.write(OpCode::CONSTANT, 2);
+    chunk.write(one, 2);
+    chunk.write(OpCode::ADD, 2);
+    chunk.write(OpCode::SET_LOCAL, 2);
+    chunk.write(1, 2);
+    chunk.write(OpCode::POP, 2);
+    write_jump(chunk, OpCode::LOOP, 20, 2);
+    // Exit: pop the condition.
+    chunk.write(OpCode::POP, 3);
+    chunk.write(OpCode::NIL, 3);
+    chunk.write(OpCode::RETURN, 3);
+
+    optimize_peephole(chunk);
+    EXPECT_EQ(opcodes(chunk),
+              (std::vector<OpCode>{
+                  OpCode::GET_LOCAL, OpCode::CONSTANT,
+                  OpCode::JUMP_IF_NOT_LESS, OpCode::ADD_LOCAL_CONST,
+                  OpCode::SET_LOCAL, OpCode::POP, OpCode::LOOP, OpCode::NIL,
+                  OpCode::RETURN}));
+    // The branch skips the loop body, and the POP that is not needed anymore.
+    EXPECT_EQ(chunk.jump_at(5), 9);
+    EXPECT_EQ(chunk.code[16].opcode, OpCode::NIL);
+    // The loop jumps back to the condition.
+    EXPECT_EQ(chunk.jump_at(14), 16);
+    EXPECT_EQ(chunk.get_line(16), 3);
+}
+
+TEST(PeepholeTests, TestNarrowWideJumps) {
+    // The compiler emits every jump wide.
+    Chunk chunk;
+    chunk.write(OpCode::TRUE, 1);
+    chunk.write(OpCode::WIDE, 1);
+    chunk.write(OpCode::JUMP_IF_FALSE_POP, 1);
+    int jump = chunk.code.size();
+    for (size_t i = 0; i < sizeof(wide_ref_t); ++i) {
+        chunk.write(0xff, 1);
+    }
+    chunk.wide_at(jump) = 1;
+    chunk.write(OpCode::NIL, 2);
+    chunk.write(OpCode::RETURN, 3);
+
+    optimize_peephole(chunk);
+    EXPECT_EQ(opcodes(chunk),
+              (std::vector<OpCode>{OpCode::TRUE, OpCode::JUMP_IF_FALSE_POP,
+                                   OpCode::NIL, OpCode::RETURN}));
+    EXPECT_EQ(chunk.jump_at(2), 1);
+    EXPECT_EQ(chunk.code[5].opcode, OpCode::RETURN);
+}
@@ -0,0 +1,397 @@
+#include "register_translator.h"
+
+#include "src/compiler/peephole.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+/** Where the value of a stack slot currently is. Only `SLOT` values are
+ * actually stored in the slot's register; the others are uses of a register or
+ * a constant that were not copied yet.
+ */
+struct Operand {
+    enum Kind { SLOT, REGISTER, CONSTANT };
+
+    Kind kind;
+    // The register of a `REGISTER`, or the constant index of a `CONSTANT`.
+    int index;
+};
+
+constexpr Operand IN_SLOT{Operand::SLOT, 0};
+
+struct Translator {
+    Translator(Chunk &chunk, int arity)
+        : chunk(chunk), is_target(chunk.code.size() + 1, false),
+          start_of(chunk.code.size() + 1, -1), stack(arity + 1, IN_SLOT) {
+        result.frame_size = stack.size();
+        for (int offset = 0; offset < static_cast<int>(chunk.code.size());
+             offset += instruction_size(chunk, offset)) {
+            if (std::optional<int> target = jump_target(offset)) {
+                is_target[*target] = true;
+            }
+        }
+    }
+
+    std::optional<int> jump_target(int offset) const {
+        bool wide = chunk.code[offset].opcode == OpCode::WIDE;
+        int next = offset + instruction_size(chunk, offset);
+        auto jump = [&]() -> int {
+            return wide ? chunk.wide_at(offset + 2) : chunk.jump_at(offset + 1);
+        };
+        switch (chunk.code[offset + wide].opcode) {
+        case OpCode::JUMP:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::JUMP_IF_TRUE:
+        case OpCode::JUMP_IF_FALSE_POP:
+        case OpCode::JUMP_IF_NOT_LESS:
+        case OpCode::JUMP_IF_NOT_GREATER:
+            return next + jump();
+        case OpCode::LOOP:
+            return next - jump();
+        default:
+            return std::nullopt;
+        }
+    }
+
+    std::optional<RegisterCode> run() {
+        int size = chunk.code.size();
+        for (int offset = 0; offset < size;
+             offset += instruction_size(chunk, offset)) {
+            line = chunk.get_line(offset);
+            // The last instruction, if it stored its result in the top slot.
+            int producer = std::exchange(result_producer, -1);
+            // Control flow merges here, so all paths must agree on where
+            // values are. The jumps flush before jumping, so flush here too.
+            if (is_target[offset]) {
+                flush();
+                producer = -1;
+            }
+            start_of[offset] = result.code.size();
+            if (!translate(offset, producer)) {
+                return std::nullopt;
+            }
+        }
+        start_of[size] = result.code.size();
+
+        for (const auto &[index, target] : forward_jumps) {
+            int jump = start_of[target] - (index + 1);
+            if (jump > static_cast<int>(REG_WIDE_MAX)) {
+                return std::nullopt;
+            }
+            result.code[index].a = jump & 0xffff;
+            result.code[index].ext = jump >> 16;
+        }
+        if (result.frame_size > K_BIT) {
+            return std::nullopt;
+        }
+        return std::move(result);
+    }
+
+    bool translate(int offset, int producer) {
+        auto operand = [&](int n) {
+            return chunk.code[offset + n].constant_ref;
+        };
+        // Wide instructions only differ in their constant or jump operand.
+        bool wide = chunk.code[offset].opcode == OpCode::WIDE;
+        OpCode opcode = chunk.code[offset + wide].opcode;
+        uint32_t constant = 0;
+        if (opcode == OpCode::CONSTANT or opcode == OpCode::CLOSURE) {
+            constant = wide ? chunk.wide_at(offset + 2) : operand(1);
+            if (constant > REG_WIDE_MAX) {
+                return false;
+            }
+        }
+        switch (opcode) {
+        case OpCode::CONSTANT:
+            if (constant < K_BIT) {
+                push(Operand{Operand::CONSTANT, static_cast<int>(constant)});
+            } else {
+                push_result(RegOpCode::LOAD_CONSTANT, constant & 0xffff, 0,
+                            constant >> 16);
+            }
+            break;
+        case OpCode::NIL:
+            push_result(RegOpCode::NIL);
+            break;
+        case OpCode::TRUE:
+            push_result(RegOpCode::TRUE);
+            break;
+        case OpCode::FALSE:
+            push_result(RegOpCode::FALSE);
+            break;
+        case OpCode::EQUAL:
+            binary(RegOpCode::EQUAL);
+            break;
+        case OpCode::NOT_EQUAL:
+            binary(RegOpCode::NOT_EQUAL);
+            break;
+        case OpCode::GREATER:
+            binary(RegOpCode::GREATER);
+            break;
+        case OpCode::LESS:
+            binary(RegOpCode::LESS);
+            break;
+        case OpCode::GREATER_EQUAL:
+            binary(RegOpCode::GREATER_EQUAL);
+            break;
+        case OpCode::LESS_EQUAL:
+            binary(RegOpCode::LESS_EQUAL);
+            break;
+        case OpCode::ADD:
+            binary(RegOpCode::ADD);
+            break;
+        case OpCode::SUBTRACT:
+            binary(RegOpCode::SUBTRACT);
+            break;
+        case OpCode::MULTIPLY:
+            binary(RegOpCode::MULTIPLY);
+            break;
+        case OpCode::DIVIDE:
+            binary(RegOpCode::DIVIDE);
+            break;
+        case OpCode::NOT:
+            push_result(RegOpCode::NOT, pop());
+            break;
+        case OpCode::NEGATE:
+            push_result(RegOpCode::NEGATE, pop());
+            break;
+        case OpCode::ADD_LOCAL_CONST: {
+            reg_operand_t local = rk(operand(1));
+            push_result(RegOpCode::ADD, local, K_BIT | operand(2));
+            break;
+        }
+        case OpCode::POP:
+            pop();
+            break;
+        case OpCode::POPN:
+            stack.resize(stack.size() - operand(1));
+            break;
+        case OpCode::GET_LOCAL: {
+            Operand local = stack[operand(1)];
+            push(local.kind == Operand::SLOT
+                     ? Operand{Operand::REGISTER, operand(1)}
+                     : local);
+            break;
+        }
+        case OpCode::SET_LOCAL:
+            set_local(operand(1), producer);
+            break;
+        case OpCode::DEFINE_GLOBAL:
+            emit(RegOpCode::DEFINE_GLOBAL, chunk.global_at(offset + 1), pop());
+            break;
+        case OpCode::GET_GLOBAL:
+            push_result(RegOpCode::GET_GLOBAL, chunk.global_at(offset + 1));
+            break;
+        case OpCode::SET_GLOBAL:
+            emit(RegOpCode::SET_GLOBAL, chunk.global_at(offset + 1), top());
+            break;
+        case OpCode::GET_UPVALUE:
+            push_result(RegOpCode::GET_UPVALUE, operand(1));
+            break;
+        case OpCode::SET_UPVALUE:
+            // An upvalue never points into the function's own frame, so this
+            // can't change a register that is used in place.
+            emit(RegOpCode::SET_UPVALUE, operand(1), top());
+            break;
+        case OpCode::PRINT:
+            emit(RegOpCode::PRINT, 0, pop());
+            break;
+        case OpCode::JUMP:
+            flush();
+            forward_jump(RegOpCode::JUMP, offset);
+            break;
+        case OpCode::LOOP: {
+            flush();
+            int jump = result.code.size() + 1 - start_of[*jump_target(offset)];
+            if (jump > static_cast<int>(REG_WIDE_MAX)) {
+                return false;
+            }
+            emit(RegOpCode::LOOP, jump & 0xffff, 0, 0, jump >> 16);
+            break;
+        }
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::JUMP_IF_TRUE:
+            flush();
+            forward_jump(opcode == OpCode::JUMP_IF_FALSE
+                             ? RegOpCode::JUMP_IF_FALSE
+                             : RegOpCode::JUMP_IF_TRUE,
+                         offset, top());
+            break;
+        case OpCode::JUMP_IF_FALSE_POP: {
+            reg_operand_t condition = pop();
+            flush();
+            forward_jump(RegOpCode::JUMP_IF_FALSE, offset, condition);
+            break;
+        }
+        case OpCode::JUMP_IF_NOT_LESS:
+        case OpCode::JUMP_IF_NOT_GREATER: {
+            reg_operand_t right = pop();
+            reg_operand_t left = pop();
+            flush();
+            forward_jump(opcode == OpCode::JUMP_IF_NOT_LESS
+                             ? RegOpCode::JUMP_IF_NOT_LESS
+                             : RegOpCode::JUMP_IF_NOT_GREATER,
+                         offset, left, right);
+            break;
+        }
+        case OpCode::CALL:
+        case OpCode::TAIL_CALL: {
+            // Arguments are passed in place, and the callee might change
+            // locals through upvalues, so everything must be in its slot.
+            flush();
+            int callee = stack.size() - operand(1) - 1;
+            emit(opcode == OpCode::CALL ? RegOpCode::CALL
+                                        : RegOpCode::TAIL_CALL,
+                 callee, operand(1));
+            stack.resize(callee);
+            push(IN_SLOT);
+            break;
+        }
+        case OpCode::CLOSURE: {
+            // Captured upvalues point to the slots themselves.
+            flush();
+            emit(RegOpCode::CLOSURE, stack.size(), constant & 0xffff, 0,
+                 constant >> 16);
+            int size = instruction_size(chunk, offset);
+            int first_capture = wide ? 2 + sizeof(wide_ref_t) : 2;
+            for (int i = first_capture; i < size; i += 2) {
+                emit(RegOpCode::CAPTURE, operand(i), operand(i + 1));
+            }
+            push(IN_SLOT);
+            break;
+        }
+        case OpCode::CLOSE_UPVALUE:
+            materialize(stack.size() - 1);
+            emit(RegOpCode::CLOSE_UPVALUE, stack.size() - 1);
+            pop();
+            break;
+        case OpCode::RETURN:
+            emit(RegOpCode::RETURN, 0, pop());
+            break;
+        case OpCode::WIDE:
+            // The prefix was decoded above, and never prefixes itself.
+            return false;
+        }
+        return true;
+    }
+
+    /** The RK operand holding the value of slot `slot`. */
+    reg_operand_t rk(int slot) const {
+        const Operand &value = stack[slot];
+        switch (value.kind) {
+        case Operand::REGISTER:
+            return value.index;
+        case Operand::CONSTANT:
+            return K_BIT | value.index;
+        case Operand::SLOT:
+        default:
+            return slot;
+        }
+    }
+
+    reg_operand_t top() const { return rk(stack.size() - 1); }
+
+    void push(Operand value) {
+        stack.push_back(value);
+        result.frame_size =
+            std::max(result.frame_size, static_cast<int>(stack.size()));
+    }
+
+    reg_operand_t pop() {
+        reg_operand_t value = top();
+        stack.pop_back();
+        return value;
+    }
+
+    void emit(RegOpCode opcode, int a = 0, int b = 0, int c = 0, int ext = 0) {
+        result.code.push_back(RegInstruction{
+            opcode, static_cast<uint8_t>(ext), static_cast<reg_operand_t>(a),
+            static_cast<reg_operand_t>(b), static_cast<reg_operand_t>(c)});
+        result.lines.push_back(line);
+    }
+
+    /** Emit an instruction that stores its result in a new top slot. */
+    void push_result(RegOpCode opcode, int b = 0, int c = 0, int ext = 0) {
+        emit(opcode, stack.size(), b, c, ext);
+        push(IN_SLOT);
+        result_producer = result.code.size() - 1;
+    }
+
+    void binary(RegOpCode opcode) {
+        reg_operand_t right = pop();
+        reg_operand_t left = pop();
+        push_result(opcode, left, right);
+    }
+
+    void forward_jump(RegOpCode opcode, int offset, int b = 0, int c = 0) {
+        forward_jumps.emplace_back(result.code.size(), *jump_target(offset));
+        emit(opcode, 0, b, c);
+    }
+
+    void set_local(int slot, int producer) {
+        int top_slot = stack.size() - 1;
+        const Operand &value = stack[top_slot];
+        if (value.kind == Operand::REGISTER and value.index == slot) {
+            return;
+        }
+        bool aliased = false;
+        for (int i = 0; i < top_slot; ++i) {
+            aliased |= is_use_of(i, slot);
+        }
+        if (!aliased and value.kind == Operand::SLOT and
+            producer == static_cast<int>(result.code.size()) - 1) {
+            // Have the producer store its result in the local directly.
+            result.code.back().a = slot;
+        } else {
+            for (int i = 0; i < top_slot; ++i) {
+                if (is_use_of(i, slot)) {
+                    materialize(i);
+                }
+            }
+            emit(RegOpCode::MOVE, slot, rk(top_slot));
+        }
+        stack[slot] = IN_SLOT;
+        stack[top_slot] = Operand{Operand::REGISTER, slot};
+    }
+
+    bool is_use_of(int slot, int reg) const {
+        return stack[slot].kind == Operand::REGISTER and
+               stack[slot].index == reg;
+    }
+
+    /** Store the value of `slot` in its register. */
+    void materialize(int slot) {
+        if (stack[slot].kind != Operand::SLOT) {
+            emit(RegOpCode::MOVE, slot, rk(slot));
+            stack[slot] = IN_SLOT;
+        }
+    }
+
+    void flush() {
+        // A `REGISTER` always refers to a `SLOT`, so the order doesn't matter.
+        for (size_t slot = 0; slot < stack.size(); ++slot) {
+            materialize(slot);
+        }
+    }
+
+    Chunk &chunk;
+    std::vector<bool> is_target;
+    // Stack code offset -> index of its first register instruction.
+    std::vector<int> start_of;
+    // (Instruction index, stack code target) of jumps to patch.
+    std::vector<std::pair<int, int>> forward_jumps;
+    std::vector<Operand> stack;
+    RegisterCode result;
+    int result_producer = -1;
+    int line = 0;
+};
+
+} // namespace
+
+std::optional<RegisterCode> translate_to_registers(Chunk &chunk, int arity) {
+    return Translator{chunk, arity}.run();
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "src/vm/chunk.h"
+#include "src/vm/register_code.h"
+
+#include <optional>
+
+/** Translate the stack code of a function with `arity` parameters into
+ * register tier code.
+ *
+ * Stack slots become registers. Values that the stack code copies around,
+ * like locals and constants, are tracked symbolically and used in place, so
+ * e.g. `GET_LOCAL 1; GET_LOCAL 2; ADD; SET_LOCAL 3; POP` becomes a single
+ * `ADD 3 1 2`. Returns `std::nullopt` if the function does not fit the
+ * register encoding.
+ */
+std::optional<RegisterCode> translate_to_registers(Chunk &chunk, int arity);
@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include "src/compiler/register_translator.h"
+#include "src/vm/chunk.h"
+
+#include <vector>
+
+std::vector<RegOpCode> opcodes(const RegisterCode &code) {
+    std::vector<RegOpCode> result;
+    for (const RegInstruction &instruction : code.code) {
+        result.push_back(instruction.opcode);
+    }
+    return result;
+}
+
+TEST(RegisterTranslatorTests, TestLocalsAreUsedInPlace) {
+    // fun f(a, b, c) { c = a + b; }
+    Chunk chunk;
+    chunk.write(OpCode::GET_LOCAL, 1);
+    chunk.write(1, 1);
+    chunk.write(OpCode::GET_LOCAL, 1);
+    chunk.write(2, 1);
+    chunk.write(OpCode::ADD, 1);
+    chunk.write(OpCode::SET_LOCAL, 1);
+    chunk.write(3, 1);
+    chunk.write(OpCode::POP, 1);
+    chunk.write(OpCode::NIL, 2);
+    chunk.write(OpCode::RETURN, 2);
+
+    auto code = translate_to_registers(chunk, 3);
+    ASSERT_TRUE(code.has_value());
+    EXPECT_EQ(opcodes(*code), (std::vector<RegOpCode>{RegOpCode::ADD,
+                                                      RegOpCode::NIL,
+                                                      RegOpCode::RETURN}));
+    const RegInstruction &add = code->code[0];
+    EXPECT_EQ(add.a, 3);
+    EXPECT_EQ(add.b, 1);
+    EXPECT_EQ(add.c, 2);
+    EXPECT_EQ(code->lines, (std::vector<int>{1, 2, 2}));
+    EXPECT_EQ(code->frame_size, 6);
+}
+
+TEST(RegisterTranslatorTests, TestOverwrittenLocalIsCopiedFirst) {
+    // fun f(a) { print a + (a = 10); }
+    Chunk chunk;
+    int ten = chunk.add_constant(10.0);
+    chunk.write(OpCode::GET_LOCAL, 1);
+    chunk.write(1, 1);
+    chunk.write(OpCode::CONSTANT, 1);
+    chunk.write(ten, 1);
+    chunk.write(OpCode::SET_LOCAL, 1);
+    chunk.write(1, 1);
+    chunk.write(OpCode::ADD, 1);
+    chunk.write(OpCode::PRINT, 1);
+    chunk.write(OpCode::NIL, 1);
+    chunk.write(OpCode::RETURN, 1);
+
+    auto code = translate_to_registers(chunk, 1);
+    ASSERT_TRUE(code.has_value());
+    EXPECT_EQ(opcodes(*code),
+              (std::vector<RegOpCode>{RegOpCode::MOVE, RegOpCode::MOVE,
+                                      RegOpCode::ADD, RegOpCode::PRINT,
+                                      RegOpCode::NIL, RegOpCode::RETURN}));
+    // The old value of `a` is saved to its temporary before `a` is set.
+    EXPECT_EQ(code->code[0].a, 2);
+    EXPECT_EQ(code->code[0].b, 1);
+    EXPECT_EQ(code->code[1].a, 1);
+    EXPECT_EQ(code->code[1].b, K_BIT | ten);
+    EXPECT_EQ(code->code[2].b, 2);
+    EXPECT_EQ(code->code[2].c, 1);
+}
@@ -1,9 +1,25 @@
 #pragma once
 
+// Optimized builds (`bazel build -c opt`, which defines NDEBUG) are for
+// running and benchmarking scripts, so they never debug.
+#ifdef NDEBUG
+constexpr bool DEBUG_BUILD = false;
+#else
+constexpr bool DEBUG_BUILD = true;
+#endif
+
 // This causes new unused template types to be compiled.
-constexpr bool DEBUG_SIZEOF_ASSERTS = true;
-constexpr bool DEBUG_TRACE_EXECUTION = false;
-constexpr bool DEBUG_PRINT_CODE = true;
+constexpr bool DEBUG_SIZEOF_ASSERTS = DEBUG_BUILD and true;
+constexpr bool DEBUG_TRACE_EXECUTION = DEBUG_BUILD and false;
+// Count the opcodes the VM runs, and their pairs. See `OpcodeStats`. Unlike
+// the other flags, it is meant for optimized builds too, so it is set by the
+// build: `bazel build -c opt --define opcode_stats=count //src:main`.
+#ifdef LOX_COUNT_OPCODES
+constexpr bool DEBUG_COUNT_OPCODES = true;
+#else
+constexpr bool DEBUG_COUNT_OPCODES = false;
+#endif
+constexpr bool DEBUG_PRINT_CODE = DEBUG_BUILD and true;
 
-constexpr bool DEBUG_STRESS_GC = true;
-constexpr bool DEBUG_LOG_GC = true;
\ No newline at end of file
+constexpr bool DEBUG_STRESS_GC = DEBUG_BUILD and true;
+constexpr bool DEBUG_LOG_GC = DEBUG_BUILD and true;
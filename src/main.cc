@@ -1,12 +1,19 @@
 #include "src/compiler/compiler.h"
+#include "src/debug_flags.h"
 #include "src/syntactics/token.h"
+#include "src/vm/bytecode_file.h"
+#include "src/vm/compile_cache.h"
+#include "src/vm/gc/gc_stats.h"
+#include "src/vm/profiler.h"
 #include "src/vm/vm.h"
 
+#include <charconv>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <sstream>
+#include <string_view>
 
 int interpret_result_to_exit_code(InterpretResult result) {
     switch (result) {
@@ -21,9 +28,7 @@ int interpret_result_to_exit_code(InterpretResult result) {
         "Unknown InterpretResult " + std::to_string(static_cast<int>(result))));
 }
 
-int repl() {
-    VM vm{InterpretMode::INTERACTIVE};
-
+int repl(VM &vm) {
     std::string s;
     std::cout << "> ";
     while (std::getline(std::cin, s)) {
@@ -34,21 +39,157 @@ int repl() {
     return 0;
 }
 
-int run_file(char *filename) {
+bool is_bytecode_file(std::string_view filename) {
+    return filename.ends_with(".loxc");
+}
+
+int run_file(char *filename, VM &vm) {
+    // Writes the profile when it goes out of scope, after the script ran.
+    auto profiler = Profiler::from_environment(vm.get_frames());
+    if (is_bytecode_file(filename)) {
+        auto script = load_bytecode(filename, vm.get_heap_manager(),
+                                    vm.get_globals());
+        if (!script.has_value()) {
+            return interpret_result_to_exit_code(
+                InterpretResult::COMPILE_ERROR);
+        }
+        return interpret_result_to_exit_code(vm.run_script(script.value()));
+    }
+    std::ifstream ifs(filename);
+    std::string source(std::istreambuf_iterator<char>(ifs), {});
+
+    std::optional<CompileCache> cache;
+    // Printing the code needs it to be compiled.
+    if constexpr (!DEBUG_PRINT_CODE) {
+        cache = CompileCache::from_environment();
+    }
+    std::optional<heap_ptr<ObjFunction>> script;
+    if (cache.has_value()) {
+        script = cache->load(source, vm.get_heap_manager(), vm.get_globals());
+    }
+    if (!script.has_value()) {
+        script = compile(vm, source);
+        if (!script.has_value()) {
+            return interpret_result_to_exit_code(
+                InterpretResult::COMPILE_ERROR);
+        }
+        if (cache.has_value()) {
+            cache->store(source, script.value(), vm.get_globals());
+        }
+    }
+    return interpret_result_to_exit_code(vm.run_script(script.value()));
+}
+
+/** Compile the script at `filename` to a bytecode file at `out_filename`,
+ * which can be run instead of the script.
+ */
+int compile_file(char *filename, char *out_filename) {
     VM vm{InterpretMode::FILE};
     std::ifstream ifs(filename);
     std::string source(std::istreambuf_iterator<char>(ifs), {});
-    InterpretResult result = interpret(vm, source);
-    return interpret_result_to_exit_code(result);
+    auto script = compile(vm, source);
+    if (!script.has_value()) {
+        return interpret_result_to_exit_code(InterpretResult::COMPILE_ERROR);
+    }
+    std::ofstream out(out_filename, std::ios::binary);
+    write_bytecode(out, script.value(), vm.get_globals());
+    out.close();
+    if (!out) {
+        std::cerr << "Could not write '" << out_filename << "'." << std::endl;
+        return 74;
+    }
+    return 0;
 }
 
-int main(int argc, char **argv) {
-    if (argc == 1) {
-        return repl();
-    } else if (argc == 2) {
-        return run_file(argv[1]);
+struct Options {
+    ExecutionTier tier = ExecutionTier::STACK;
+    // Print a summary of the garbage collector's work at exit.
+    bool gc_stats = false;
+    std::optional<double> growth_factor;
+    std::optional<size_t> min_heap_size;
+};
+
+template <typename T>
+std::optional<T> parse_number(std::string_view text) {
+    T number;
+    auto [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), number);
+    if (error != std::errc() or end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+/** Parse `option` into `options`. Returns false if it isn't valid. */
+bool parse_option(std::string_view option, Options &options) {
+    constexpr std::string_view GROWTH_FACTOR = "--gc-growth-factor=";
+    constexpr std::string_view MIN_HEAP = "--gc-min-heap=";
+    if (option == "--registers") {
+        options.tier = ExecutionTier::REGISTER;
+    } else if (option == "--gc-stats") {
+        options.gc_stats = true;
+    } else if (option.starts_with(GROWTH_FACTOR)) {
+        options.growth_factor =
+            parse_number<double>(option.substr(GROWTH_FACTOR.size()));
+        // A smaller factor would collect on every allocation.
+        return options.growth_factor.has_value() and
+               options.growth_factor.value() > 1;
+    } else if (option.starts_with(MIN_HEAP)) {
+        options.min_heap_size =
+            parse_number<size_t>(option.substr(MIN_HEAP.size()));
+        return options.min_heap_size.has_value();
     } else {
-        std::cout << "Usage: cpplox [script]" << std::endl;
-        return 1;
+        return false;
+    }
+    return true;
+}
+
+int usage() {
+    std::cout
+        << "Usage: cpplox [options] [script | file.loxc]\n"
+           "       cpplox --compile file.loxc script\n"
+           "Options:\n"
+           "  --registers              Run on the register tier.\n"
+           "  --gc-stats               Print the garbage collector's stats "
+           "at exit.\n"
+           "  --gc-growth-factor=<x>   Collect once the heap grows to x "
+           "times its\n"
+           "                           live size (default 2).\n"
+           "  --gc-min-heap=<bytes>    Don't collect before the heap reaches "
+           "this size."
+        << std::endl;
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 4 and std::string_view(argv[1]) == "--compile") {
+        return compile_file(argv[3], argv[2]);
     }
-}
\ No newline at end of file
+
+    Options options;
+    while (argc > 1 and std::string_view(argv[1]).starts_with("--")) {
+        if (!parse_option(argv[1], options)) {
+            return usage();
+        }
+        --argc;
+        ++argv;
+    }
+    if (argc > 2) {
+        return usage();
+    }
+
+    VM vm{argc == 1 ? InterpretMode::INTERACTIVE : InterpretMode::FILE,
+          options.tier};
+    Heap &heap = vm.get_heap_manager().get_heap();
+    if (options.growth_factor.has_value()) {
+        heap.set_growth_factor(options.growth_factor.value());
+    }
+    if (options.min_heap_size.has_value()) {
+        heap.set_min_heap_size(options.min_heap_size.value());
+    }
+    int exit_code = argc == 1 ? repl(vm) : run_file(argv[1], vm);
+    if (options.gc_stats) {
+        gc::print_summary(heap, std::cerr);
+    }
+    return exit_code;
+}
@@ -0,0 +1,610 @@
+#include "bytecode_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstring>
+#include <fmt/format.h>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/* File layout. Every integer is stored in the byte order of the machine that
+ * wrote the file, which is checked by `Header::byte_order`.
+ *
+ *   Header
+ *   strings:   string_count * (u32 size, bytes)
+ *   globals:   global_count * (u32 string index of the slot's name)
+ *   functions: function_count * Function
+ *
+ * A function is
+ *
+ *   u32 name string index, or NO_STRING for the script
+ *   u32 arity, u32 upvalue count
+ *   u32 constant count, constants: (u8 ConstantTag, payload)
+ *   u32 code size, code bytes
+ *   u32 line run count, line runs: (i32 line, i32 instruction count)
+ *
+ * Functions come after the functions in their constants, so the script is the
+ * last one.
+ */
+
+namespace {
+
+constexpr char MAGIC[4] = {'L', 'O', 'X', 'C'};
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr uint32_t NO_STRING = std::numeric_limits<uint32_t>::max();
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    // Files written by a build with another instruction set are rejected.
+    uint32_t opcode_count;
+    uint32_t string_count;
+    uint32_t global_count;
+    uint32_t function_count;
+};
+
+enum struct ConstantTag : uint8_t {
+    NIL,
+    FALSE,
+    TRUE,
+    NUMBER,
+    STRING,
+    FUNCTION
+};
+
+template <typename T>
+void put(std::string &out, T value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+struct Writer {
+    Writer(const Globals &globals) : globals(globals) {}
+
+    void write(std::ostream &out, heap_ptr<ObjFunction> script) {
+        uint32_t function_count = function(script) + 1;
+        std::string names;
+        for (size_t slot = 0; slot < globals.values.size(); ++slot) {
+            put<uint32_t>(names, string(globals.name(slot)));
+        }
+
+        Header data;
+        std::memcpy(data.magic, MAGIC, sizeof(MAGIC));
+        data.version = BYTECODE_VERSION;
+        data.byte_order = BYTE_ORDER_MARK;
+        data.opcode_count = OPCODE_COUNT;
+        data.string_count = strings.size();
+        data.global_count = globals.values.size();
+        data.function_count = function_count;
+        std::string header;
+        put(header, data);
+        for (heap_ptr<ObjString> string : strings) {
+            put<uint32_t>(header, string->str().size());
+            header += string->str();
+        }
+        out << header << names << functions;
+    }
+
+    uint32_t string(heap_ptr<ObjString> string) {
+        auto [it, inserted] =
+            string_indices.try_emplace(string.get(), strings.size());
+        if (inserted) {
+            strings.push_back(string);
+        }
+        return it->second;
+    }
+
+    /** Write `function`, after the functions it refers to, and return its
+     * index.
+     */
+    uint32_t function(heap_ptr<ObjFunction> function) {
+        std::string record;
+        put<uint32_t>(record, function->name == nullptr
+                                  ? NO_STRING
+                                  : string(function->name));
+        put<uint32_t>(record, function->arity);
+        put<uint32_t>(record, function->upvalue_count);
+
+        const Chunk &chunk = function->chunk;
+        put<uint32_t>(record, chunk.constants.size());
+        for (const Value &constant : chunk.constants) {
+            switch (constant.type()) {
+            case ValueType::NIL:
+                put(record, ConstantTag::NIL);
+                break;
+            case ValueType::BOOL:
+                put(record, constant.as_bool() ? ConstantTag::TRUE
+                                               : ConstantTag::FALSE);
+                break;
+            case ValueType::NUMBER:
+                put(record, ConstantTag::NUMBER);
+                put(record, constant.as_number());
+                break;
+            case ValueType::STRING:
+                put(record, ConstantTag::STRING);
+                put<uint32_t>(record, string(constant.as_string()));
+                break;
+            case ValueType::FUNCTION:
+                put(record, ConstantTag::FUNCTION);
+                put<uint32_t>(record, this->function(constant.as_function()));
+                break;
+            default:
+                throw std::runtime_error(
+                    "Constant can't be written to a bytecode file.");
+            }
+        }
+
+        put<uint32_t>(record, chunk.code.size());
+        record.append(reinterpret_cast<const char *>(chunk.code.data()),
+                      chunk.code.size());
+        const auto &lines = chunk.line_data().lines;
+        put<uint32_t>(record, lines.size());
+        for (const auto &[line, count] : lines) {
+            put<int32_t>(record, line);
+            put<int32_t>(record, count);
+        }
+
+        functions += record;
+        return function_count++;
+    }
+
+    const Globals &globals;
+    std::vector<heap_ptr<ObjString>> strings;
+    std::unordered_map<const HeapObj<ObjString> *, uint32_t> string_indices;
+    std::string functions;
+    uint32_t function_count = 0;
+};
+
+/** Bounds checked reads from the file. */
+struct Reader {
+    template <typename T>
+    bool get(T &value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (static_cast<size_t>(end - position) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, position, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+
+    bool get_bytes(size_t size, std::string_view &bytes) {
+        if (static_cast<size_t>(end - position) < size) {
+            return false;
+        }
+        bytes = std::string_view(position, size);
+        position += size;
+        return true;
+    }
+
+    const char *position;
+    const char *end;
+};
+
+struct Loader {
+    Loader(std::span<const char> data, HeapManager &heap_manager,
+           Globals &globals, bool report_errors)
+        : reader{data.data(), data.data() + data.size()},
+          heap_manager(heap_manager), globals(globals),
+          report_errors(report_errors) {}
+
+    ~Loader() {
+        for (size_t i = 0; i < functions.size(); ++i) {
+            heap_manager.pop_root();
+        }
+    }
+
+    std::optional<heap_ptr<ObjFunction>> run() {
+        Header header;
+        if (!reader.get(header) or
+            std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+            fail("not a bytecode file");
+            return std::nullopt;
+        }
+        if (header.version != BYTECODE_VERSION or
+            header.byte_order != BYTE_ORDER_MARK or
+            header.opcode_count != OPCODE_COUNT) {
+            fail("written by another version");
+            return std::nullopt;
+        }
+
+        for (uint32_t i = 0; i < header.string_count; ++i) {
+            uint32_t size;
+            std::string_view string;
+            if (!reader.get(size) or !reader.get_bytes(size, string)) {
+                fail("truncated strings");
+                return std::nullopt;
+            }
+            strings.push_back(string);
+        }
+        interned.resize(strings.size(), heap_ptr<ObjString>(nullptr));
+
+        for (uint32_t i = 0; i < header.global_count; ++i) {
+            uint32_t name;
+            if (!reader.get(name) or name >= strings.size()) {
+                fail("bad global name");
+                return std::nullopt;
+            }
+            global_names.push_back(name);
+        }
+        global_slots.resize(global_names.size());
+
+        if (header.function_count == 0) {
+            fail("no script");
+            return std::nullopt;
+        }
+        for (uint32_t i = 0; i < header.function_count; ++i) {
+            if (!load_function()) {
+                return std::nullopt;
+            }
+        }
+        if (reader.position != reader.end) {
+            fail("trailing data");
+            return std::nullopt;
+        }
+        return functions.back();
+    }
+
+    bool load_function() {
+        uint32_t name, arity, upvalue_count, constant_count;
+        if (!reader.get(name) or !reader.get(arity) or
+            !reader.get(upvalue_count) or !reader.get(constant_count)) {
+            return fail("truncated function");
+        }
+        if (arity > std::numeric_limits<const_ref_t>::max() or
+            upvalue_count > std::numeric_limits<const_ref_t>::max()) {
+            return fail("bad function");
+        }
+        heap_ptr<ObjString> name_string(nullptr);
+        if (name != NO_STRING and !string(name, name_string)) {
+            return false;
+        }
+        heap_ptr<ObjFunction> function = heap_manager.new_function(name_string);
+        heap_manager.push_root(function);
+        functions.push_back(function);
+        function->arity = arity;
+        function->upvalue_count = upvalue_count;
+
+        Chunk &chunk = function->chunk;
+        for (uint32_t i = 0; i < constant_count; ++i) {
+            std::optional<Value> constant = load_constant();
+            if (!constant.has_value()) {
+                return false;
+            }
+            chunk.add_constant(*constant);
+            heap_manager.get_heap().write_barrier(function.get(), *constant);
+        }
+
+        uint32_t code_size, line_count;
+        std::string_view code;
+        if (!reader.get(code_size) or !reader.get_bytes(code_size, code) or
+            !reader.get(line_count)) {
+            return fail("truncated code");
+        }
+        size_t offset = 0;
+        int last_line = std::numeric_limits<int>::min();
+        for (uint32_t i = 0; i < line_count; ++i) {
+            int32_t line, count;
+            if (!reader.get(line) or !reader.get(count)) {
+                return fail("truncated lines");
+            }
+            if (line < last_line or count <= 0 or
+                static_cast<size_t>(count) > code.size() - offset) {
+                return fail("bad lines");
+            }
+            for (int32_t j = 0; j < count; ++j) {
+                chunk.write(static_cast<const_ref_t>(code[offset++]), line);
+            }
+            last_line = line;
+        }
+        if (offset != code.size()) {
+            return fail("bad lines");
+        }
+        return check_code(*function);
+    }
+
+    std::optional<Value> load_constant() {
+        ConstantTag tag;
+        if (!reader.get(tag)) {
+            fail("truncated constants");
+            return std::nullopt;
+        }
+        switch (tag) {
+        case ConstantTag::NIL:
+            return Value();
+        case ConstantTag::FALSE:
+            return Value(false);
+        case ConstantTag::TRUE:
+            return Value(true);
+        case ConstantTag::NUMBER: {
+            double number;
+            if (!reader.get(number)) {
+                fail("truncated constants");
+                return std::nullopt;
+            }
+            // Other NaNs could decode as a boxed value.
+            if (std::isnan(number)) {
+                number = std::numeric_limits<double>::quiet_NaN();
+            }
+            return Value(number);
+        }
+        case ConstantTag::STRING: {
+            uint32_t index;
+            heap_ptr<ObjString> string_value(nullptr);
+            if (!reader.get(index) or !string(index, string_value)) {
+                fail("bad string constant");
+                return std::nullopt;
+            }
+            return Value(string_value);
+        }
+        case ConstantTag::FUNCTION: {
+            uint32_t index;
+            // Only functions that were already loaded, so there are no cycles.
+            if (!reader.get(index) or index >= functions.size()) {
+                fail("bad function constant");
+                return std::nullopt;
+            }
+            return Value(functions[index]);
+        }
+        default:
+            fail("bad constant");
+            return std::nullopt;
+        }
+    }
+
+    /** Check that the code only has valid instructions, whose operands refer
+     * to existing constants, upvalues, globals and instructions. Global
+     * operands are changed to the slots of the loading VM.
+     */
+    bool check_code(ObjFunction &function) {
+        Chunk &chunk = function.chunk;
+        int size = chunk.code.size();
+        int constant_count = chunk.constants.size();
+        std::vector<bool> is_instruction(size, false);
+        std::vector<int> jump_targets;
+        for (int offset = 0; offset < size;) {
+            is_instruction[offset] = true;
+            auto opcode_at = [&](int at) {
+                return static_cast<int>(chunk.code[at].opcode);
+            };
+            if (opcode_at(offset) < 0 or opcode_at(offset) >= OPCODE_COUNT) {
+                return fail("bad opcode");
+            }
+            OpCode opcode = chunk.code[offset].opcode;
+            bool wide = opcode == OpCode::WIDE;
+            if (wide) {
+                if (offset + 1 >= size or opcode_at(offset + 1) < 0 or
+                    opcode_at(offset + 1) >= OPCODE_COUNT) {
+                    return fail("bad opcode");
+                }
+                opcode = chunk.code[offset + 1].opcode;
+            }
+            int operand = offset + 1 + wide;
+
+            int operand_size = 0;
+            bool has_constant = false;
+            bool is_jump = false;
+            switch (opcode) {
+            case OpCode::CONSTANT:
+            case OpCode::CLOSURE:
+                operand_size = wide ? sizeof(wide_ref_t) : 1;
+                has_constant = true;
+                break;
+            case OpCode::JUMP:
+            case OpCode::JUMP_IF_FALSE:
+            case OpCode::JUMP_IF_TRUE:
+            case OpCode::JUMP_IF_FALSE_POP:
+            case OpCode::JUMP_IF_NOT_LESS:
+            case OpCode::JUMP_IF_NOT_GREATER:
+            case OpCode::LOOP:
+                operand_size = wide ? sizeof(wide_ref_t) : sizeof(jump_off_t);
+                is_jump = true;
+                break;
+            default:
+                if (wide) {
+                    return fail("bad wide instruction");
+                }
+                break;
+            }
+            switch (opcode) {
+            case OpCode::GET_LOCAL:
+            case OpCode::SET_LOCAL:
+            case OpCode::GET_UPVALUE:
+            case OpCode::SET_UPVALUE:
+            case OpCode::CALL:
+            case OpCode::TAIL_CALL:
+            case OpCode::POPN:
+                operand_size = 1;
+                break;
+            case OpCode::ADD_LOCAL_CONST:
+                operand_size = 2;
+                break;
+            case OpCode::DEFINE_GLOBAL:
+            case OpCode::GET_GLOBAL:
+            case OpCode::SET_GLOBAL:
+                operand_size = sizeof(global_ref_t);
+                break;
+            default:
+                break;
+            }
+            int next = operand + operand_size;
+            if (next > size) {
+                return fail("truncated instruction");
+            }
+
+            if (has_constant) {
+                int constant = wide ? chunk.wide_at(operand)
+                                    : chunk.code[operand].constant_ref;
+                if (constant >= constant_count) {
+                    return fail("bad constant operand");
+                }
+                if (opcode == OpCode::CLOSURE) {
+                    const Value &value = chunk.constants[constant];
+                    if (!value.is_function()) {
+                        return fail("bad closure");
+                    }
+                    int upvalue_count = value.as_function()->upvalue_count;
+                    if (next + 2 * upvalue_count > size) {
+                        return fail("truncated instruction");
+                    }
+                    for (int i = 0; i < upvalue_count; ++i, next += 2) {
+                        int is_local = chunk.code[next].constant_ref;
+                        int index = chunk.code[next + 1].constant_ref;
+                        if (is_local > 1 or
+                            (!is_local and index >= function.upvalue_count)) {
+                            return fail("bad upvalue");
+                        }
+                    }
+                }
+            } else if (is_jump) {
+                long jump =
+                    wide ? chunk.wide_at(operand) : chunk.jump_at(operand);
+                long target =
+                    opcode == OpCode::LOOP ? next - jump : next + jump;
+                if (target < 0 or target >= size) {
+                    return fail("bad jump");
+                }
+                jump_targets.push_back(target);
+            } else if (opcode == OpCode::GET_UPVALUE or
+                       opcode == OpCode::SET_UPVALUE) {
+                if (chunk.code[operand].constant_ref >=
+                    function.upvalue_count) {
+                    return fail("bad upvalue");
+                }
+            } else if (opcode == OpCode::ADD_LOCAL_CONST) {
+                if (chunk.code[operand + 1].constant_ref >= constant_count) {
+                    return fail("bad constant operand");
+                }
+            } else if (opcode == OpCode::DEFINE_GLOBAL or
+                       opcode == OpCode::GET_GLOBAL or
+                       opcode == OpCode::SET_GLOBAL) {
+                std::optional<global_ref_t> slot =
+                    global(chunk.global_at(operand));
+                if (!slot.has_value()) {
+                    return false;
+                }
+                chunk.global_at(operand) = *slot;
+            }
+            offset = next;
+        }
+        // Only now are the instructions after a forward jump known.
+        for (int target : jump_targets) {
+            if (!is_instruction[target]) {
+                return fail("bad jump");
+            }
+        }
+        return true;
+    }
+
+    /** The interned string at `index`, interned on first use. */
+    bool string(uint32_t index, heap_ptr<ObjString> &result) {
+        if (index >= strings.size()) {
+            return fail("bad string");
+        }
+        if (interned[index] == nullptr) {
+            interned[index] = heap_manager.initialize(strings[index]);
+        }
+        result = interned[index];
+        return true;
+    }
+
+    /** The slot of the file's global `index`, resolved on first use. */
+    std::optional<global_ref_t> global(uint32_t index) {
+        if (index >= global_names.size()) {
+            fail("bad global");
+            return std::nullopt;
+        }
+        if (!global_slots[index].has_value()) {
+            heap_ptr<ObjString> name(nullptr);
+            string(global_names[index], name);
+            global_slots[index] = globals.resolve(name);
+            if (!global_slots[index].has_value()) {
+                fail("too many globals");
+                return std::nullopt;
+            }
+        }
+        return global_slots[index];
+    }
+
+    /** Report why the file is rejected. Always returns false. */
+    bool fail(const char *reason) {
+        if (report_errors) {
+            std::cerr << fmt::format("Invalid bytecode file: {}.\n", reason);
+        }
+        return false;
+    }
+
+    Reader reader;
+    HeapManager &heap_manager;
+    Globals &globals;
+    bool report_errors;
+    std::vector<std::string_view> strings;
+    // Null until the string is first used.
+    std::vector<heap_ptr<ObjString>> interned;
+    std::vector<uint32_t> global_names;
+    std::vector<std::optional<global_ref_t>> global_slots;
+    // Every loaded function is kept as a root until loading is done.
+    std::vector<heap_ptr<ObjFunction>> functions;
+};
+
+} // namespace
+
+void write_bytecode(std::ostream &out, heap_ptr<ObjFunction> script,
+                    const Globals &globals) {
+    Writer{globals}.write(out, script);
+}
+
+std::optional<heap_ptr<ObjFunction>> load_bytecode(const std::string &path,
+                                                   HeapManager &heap_manager,
+                                                   Globals &globals,
+                                                   bool report_errors) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 or fstat(fd, &file_stat) < 0) {
+        if (report_errors) {
+            std::cerr << fmt::format("Could not open bytecode file '{}'.\n",
+                                     path);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        return std::nullopt;
+    }
+    size_t size = file_stat.st_size;
+    // An empty file can't be mapped, but it is rejected all the same.
+    void *data = size == 0 ? nullptr
+                           : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        if (report_errors) {
+            std::cerr << fmt::format("Could not map bytecode file '{}'.\n",
+                                     path);
+        }
+        return std::nullopt;
+    }
+
+    auto script = load_bytecode(
+        std::span<const char>(static_cast<const char *>(data), size),
+        heap_manager, globals, report_errors);
+    if (data != nullptr) {
+        munmap(data, size);
+    }
+    return script;
+}
+
+std::optional<heap_ptr<ObjFunction>> load_bytecode(std::span<const char> data,
+                                                   HeapManager &heap_manager,
+                                                   Globals &globals,
+                                                   bool report_errors) {
+    return Loader{data, heap_manager, globals, report_errors}.run();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "src/vm/globals.h"
+#include "src/vm/heap_manager.h"
+#include "src/vm/obj_function.h"
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+
+/** Version of the bytecode file layout. Must be bumped whenever the layout,
+ * the meaning of an opcode, or the code the compiler emits changes, since
+ * files don't store the source and the compile cache is keyed by it.
+ */
+constexpr uint32_t BYTECODE_VERSION = 2;
+
+/** Write the compiled `script`, and every function nested in it, to `out`.
+ *
+ * Global operands are slots of `globals`, so the names of the slots are saved
+ * too, and resolved again when loading.
+ */
+void write_bytecode(std::ostream &out, heap_ptr<ObjFunction> script,
+                    const Globals &globals);
+
+/** Load a script written by `write_bytecode`. The file is mapped rather than
+ * read, and strings are only interned when a function refers to them.
+ *
+ * The header, and every instruction's opcode and operands, are checked before
+ * anything runs. Returns std::nullopt if the file can't be loaded, and
+ * reports the reason if `report_errors`.
+ */
+std::optional<heap_ptr<ObjFunction>> load_bytecode(const std::string &path,
+                                                   HeapManager &heap_manager,
+                                                   Globals &globals,
+                                                   bool report_errors = true);
+std::optional<heap_ptr<ObjFunction>> load_bytecode(std::span<const char> data,
+                                                   HeapManager &heap_manager,
+                                                   Globals &globals,
+                                                   bool report_errors = true);
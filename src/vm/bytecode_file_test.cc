@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include "src/compiler/peephole.h"
+#include "src/vm/bytecode_file.h"
+#include "src/vm/vm.h"
+
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+
+namespace {
+
+std::string compile_to_bytecode(const std::string &source) {
+    VM vm{InterpretMode::FILE};
+    auto script = compile(vm, source);
+    EXPECT_TRUE(script.has_value());
+    std::ostringstream out;
+    write_bytecode(out, script.value(), vm.get_globals());
+    return out.str();
+}
+
+/** Compile `source`, let `corrupt` change the code of the script, and write
+ * the result.
+ */
+std::string compile_corrupted(const std::string &source,
+                              const std::function<void(Chunk &)> &corrupt) {
+    VM vm{InterpretMode::FILE};
+    auto script = compile(vm, source);
+    EXPECT_TRUE(script.has_value());
+    corrupt(script.value()->chunk);
+    std::ostringstream out;
+    write_bytecode(out, script.value(), vm.get_globals());
+    return out.str();
+}
+
+/** The offset of the first `opcode` instruction in `chunk`. */
+int find_instruction(const Chunk &chunk, OpCode opcode) {
+    int offset = 0;
+    while (chunk.code[offset].opcode != opcode) {
+        offset += instruction_size(chunk, offset);
+    }
+    return offset;
+}
+
+/** The first function among the constants of `chunk`. */
+heap_ptr<ObjFunction> function_constant(const Chunk &chunk) {
+    for (const Value &constant : chunk.constants) {
+        if (constant.is_function()) {
+            return constant.as_function();
+        }
+    }
+    return heap_ptr<ObjFunction>(nullptr);
+}
+
+std::optional<heap_ptr<ObjFunction>> load(VM &vm, const std::string &file) {
+    return load_bytecode(std::span<const char>(file.data(), file.size()),
+                         vm.get_heap_manager(), vm.get_globals());
+}
+
+} // namespace
+
+TEST(BytecodeFileTests, TestRoundTrip) {
+    std::string file = compile_to_bytecode(R"(
+        var greeting = "hello";
+        fun make_counter(start) {
+            var count = start;
+            fun counter() {
+                count = count + 1;
+                return count;
+            }
+            return counter;
+        }
+        var counter = make_counter(10);
+        counter();
+        if (counter() != 12) fail();
+        if (greeting + " world" != "hello world") fail();
+        if (clock() < 0) fail();
+    )");
+
+    VM vm{InterpretMode::FILE};
+    // Globals get other slots in the loading VM.
+    ASSERT_EQ(interpret(vm, "var other = nil;"), InterpretResult::OK);
+    auto script = load(vm, file);
+    ASSERT_TRUE(script.has_value());
+    EXPECT_EQ(vm.run_script(script.value()), InterpretResult::OK);
+}
+
+TEST(BytecodeFileTests, TestTruncatedFileIsRejected) {
+    std::string file = compile_to_bytecode("fun f(x) { return x; } f(1);");
+    for (size_t size = 0; size < file.size(); ++size) {
+        VM vm{InterpretMode::FILE};
+        EXPECT_FALSE(load(vm, file.substr(0, size)).has_value());
+    }
+}
+
+TEST(BytecodeFileTests, TestBadOpcodeIsRejected) {
+    std::string file = compile_to_bytecode("print 1;");
+    // The script's last instruction, followed by its single line run.
+    size_t last_instruction =
+        file.size() - 2 * sizeof(int32_t) - sizeof(uint32_t) - 1;
+    ASSERT_EQ(file[last_instruction], static_cast<char>(OpCode::RETURN));
+    file[last_instruction] = 0x7f;
+
+    VM vm{InterpretMode::FILE};
+    EXPECT_FALSE(load(vm, file).has_value());
+}
+
+TEST(BytecodeFileTests, TestNumberConstantCantBeBoxedValue) {
+    std::string file = compile_to_bytecode("print 1.5;");
+    double number = 1.5;
+    size_t position = file.find(std::string_view(
+        reinterpret_cast<const char *>(&number), sizeof(number)));
+    ASSERT_NE(position, std::string::npos);
+    // A NaN whose bits are those of a boxed object.
+    uint64_t bits = 0xfffc000000001230;
+    std::memcpy(&file[position], &bits, sizeof(bits));
+
+    VM vm{InterpretMode::FILE};
+    auto script = load(vm, file);
+    ASSERT_TRUE(script.has_value());
+    const Value &constant = script.value()->chunk.constants[0];
+    ASSERT_TRUE(constant.is_number());
+    EXPECT_TRUE(std::isnan(constant.as_number()));
+}
+
+TEST(BytecodeFileTests, TestJumpPastCodeIsRejected) {
+    std::string file =
+        compile_corrupted("var a = true; if (a) print 300;", [](Chunk &chunk) {
+            int jump = find_instruction(chunk, OpCode::JUMP);
+            int next = jump + 1 + sizeof(jump_off_t);
+            chunk.jump_at(jump + 1) = chunk.code.size() - next;
+        });
+    VM vm{InterpretMode::FILE};
+    EXPECT_FALSE(load(vm, file).has_value());
+}
+
+TEST(BytecodeFileTests, TestJumpIntoOperandsIsRejected) {
+    std::string file =
+        compile_corrupted("var a = true; if (a) print 300;", [](Chunk &chunk) {
+            int jump = find_instruction(chunk, OpCode::JUMP_IF_FALSE_POP);
+            int next = jump + 1 + sizeof(jump_off_t);
+            int constant = find_instruction(chunk, OpCode::CONSTANT);
+            ASSERT_GT(constant, jump);
+            // The constant's operand.
+            chunk.jump_at(jump + 1) = constant + 1 - next;
+        });
+    VM vm{InterpretMode::FILE};
+    EXPECT_FALSE(load(vm, file).has_value());
+}
+
+TEST(BytecodeFileTests, TestBadUpvalueIsRejected) {
+    std::string source = R"(
+        fun outer() {
+            var x = 1;
+            fun inner() { return x; }
+            return inner;
+        }
+    )";
+    std::string file = compile_corrupted(source, [](Chunk &chunk) {
+        heap_ptr<ObjFunction> outer = function_constant(chunk);
+        heap_ptr<ObjFunction> inner = function_constant(outer->chunk);
+        Chunk &code = inner->chunk;
+        ASSERT_EQ(inner->upvalue_count, 1);
+        code.code[find_instruction(code, OpCode::GET_UPVALUE) + 1] =
+            const_ref_t{1};
+    });
+    VM vm{InterpretMode::FILE};
+    EXPECT_FALSE(load(vm, file).has_value());
+}
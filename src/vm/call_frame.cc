@@ -0,0 +1,66 @@
+#include "call_frame.h"
+
+#include <algorithm>
+
+CallFrame::CallFrame(heap_ptr<ObjClosure> closure, CodeVec::const_iterator ip,
+                     Value *slots)
+    : closure(closure), ip(std::move(ip)), slots(slots), reg_ip(nullptr),
+      top(nullptr), tail_called(false) {}
+
+CallFrame::CallFrame(heap_ptr<ObjClosure> closure,
+                     const RegInstruction *reg_ip, Value *slots, Value *top)
+    : closure(closure), slots(slots), reg_ip(reg_ip), top(top),
+      tail_called(false) {}
+
+Chunk &CallFrame::chunk() { return closure->function->chunk; }
+
+int CallFrame::current_line() {
+    auto function = closure->function;
+    if (reg_ip != nullptr) {
+        const RegisterCode &code = *function->register_code;
+        return code.lines[reg_ip - code.code.data() - 1];
+    }
+    return function->chunk.get_line(ip - function->chunk.code.begin() - 1);
+}
+
+FrameStack::FrameStack(size_t max_frames)
+    : current(0), max_frames(max_frames) {
+    segments.push_back(std::make_unique<Segment>(nullptr));
+    enter_segment(0);
+    top.store(segment_begin, std::memory_order_relaxed);
+}
+
+void FrameStack::clear() {
+    enter_segment(0);
+    top.store(segment_begin, std::memory_order_relaxed);
+}
+
+size_t FrameStack::get_max_frames() const { return max_frames; }
+
+void FrameStack::set_max_frames(size_t max_frames) {
+    this->max_frames = max_frames;
+    enter_segment(current);
+}
+
+void FrameStack::enter_segment(size_t index) {
+    current = index;
+    current_segment.store(segments[index].get(), std::memory_order_release);
+    segment_begin = segments[index]->frames();
+    segment_end = segment_begin + SEGMENT_FRAMES;
+    size_t first = index * SEGMENT_FRAMES;
+    size_t room = max_frames > first ? max_frames - first : 0;
+    limit = segment_begin + std::min(room, SEGMENT_FRAMES);
+}
+
+void FrameStack::next_segment() {
+    if (current + 1 == segments.size()) {
+        segments.push_back(std::make_unique<Segment>(segments.back().get()));
+    }
+    enter_segment(current + 1);
+    top.store(segment_begin, std::memory_order_release);
+}
+
+void FrameStack::previous_segment() {
+    enter_segment(current - 1);
+    top.store(segment_end, std::memory_order_release);
+}
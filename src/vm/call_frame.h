@@ -0,0 +1,162 @@
+#pragma once
+
+#include "src/vm/chunk.h"
+#include "src/vm/gc/heap_obj.h"
+#include "src/vm/obj_function.h"
+#include "src/vm/register_code.h"
+#include "src/vm/value.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+struct CallFrame {
+    CallFrame(heap_ptr<ObjClosure> closure, CodeVec::const_iterator ip,
+              Value *slots);
+    CallFrame(heap_ptr<ObjClosure> closure, const RegInstruction *reg_ip,
+              Value *slots, Value *top);
+    Chunk &chunk();
+    /** Source line of the instruction being executed. */
+    int current_line();
+
+    heap_ptr<ObjClosure> closure;
+    CodeVec::const_iterator ip;
+    // Start of the frame's window into the VM stack.
+    Value *const slots;
+    // Register tier only: the next instruction, and the stack top while the
+    // frame runs. The top covers the caller's registers too, so the GC never
+    // sees stale values above them.
+    const RegInstruction *reg_ip;
+    Value *top;
+    // Whether the frame replaced the frames of tail calls, which stack traces
+    // can't show.
+    bool tail_called;
+};
+
+/** The stack of call frames. Frames are stored in fixed size segments, which
+ * are allocated as the stack first grows into them and kept until the stack
+ * is destroyed, so frames never move and pushing or popping a frame is a
+ * pointer bump except at the edge of a segment.
+ *
+ * The frames can be read by `visit` from a signal handler that interrupted
+ * the thread using the stack, e.g. by a profiler.
+ */
+struct FrameStack {
+    static constexpr size_t SEGMENT_FRAMES = 1024;
+
+    FrameStack(size_t max_frames);
+
+    /** Whether pushing a frame would exceed the recursion limit. */
+    bool full() const {
+        return top.load(std::memory_order_relaxed) >= limit and
+               size() >= max_frames;
+    }
+    template <typename... Args>
+    CallFrame &emplace_back(Args &&...args) {
+        CallFrame *frame = top.load(std::memory_order_relaxed);
+        if (frame == segment_end) {
+            next_segment();
+            frame = segment_begin;
+        }
+        new (frame) CallFrame(std::forward<Args>(args)...);
+        // Only publish the frame once it is complete.
+        top.store(frame + 1, std::memory_order_release);
+        return *frame;
+    }
+    void pop_back() {
+        CallFrame *frame = top.load(std::memory_order_relaxed) - 1;
+        top.store(frame, std::memory_order_relaxed);
+        if (frame == segment_begin and current > 0) {
+            previous_segment();
+        }
+    }
+
+    CallFrame &back() { return top.load(std::memory_order_relaxed)[-1]; }
+    CallFrame &operator[](size_t index) {
+        return segments[index / SEGMENT_FRAMES]->frames()[index %
+                                                          SEGMENT_FRAMES];
+    }
+    size_t size() const {
+        return current * SEGMENT_FRAMES +
+               (top.load(std::memory_order_relaxed) - segment_begin);
+    }
+    bool empty() const {
+        return top.load(std::memory_order_relaxed) == segment_begin;
+    }
+    void clear();
+
+    /** Call `visitor` on the frames from the top down, until it returns false.
+     * Safe to call from a signal handler interrupting the thread using the
+     * stack. Returns false if the stack was caught moving between segments,
+     * in which case nothing was visited.
+     */
+    template <typename Visit>
+    bool visit(Visit visitor) const {
+        const Segment *segment =
+            current_segment.load(std::memory_order_acquire);
+        const CallFrame *frame = top.load(std::memory_order_acquire);
+        if (frame < segment->frames() or
+            frame > segment->frames() + SEGMENT_FRAMES) {
+            return false;
+        }
+        while (true) {
+            while (frame > segment->frames()) {
+                if (!visitor(*--frame)) {
+                    return true;
+                }
+            }
+            segment = segment->previous;
+            if (segment == nullptr) {
+                return true;
+            }
+            // Segments below the top one are full.
+            frame = segment->frames() + SEGMENT_FRAMES;
+        }
+    }
+
+    size_t get_max_frames() const;
+    void set_max_frames(size_t max_frames);
+
+    FrameStack(const FrameStack &) = delete;
+    FrameStack &operator=(const FrameStack &) = delete;
+
+  private:
+    struct Segment {
+        Segment(const Segment *previous) : previous(previous) {}
+
+        CallFrame *frames() {
+            return std::launder(reinterpret_cast<CallFrame *>(storage));
+        }
+        const CallFrame *frames() const {
+            return std::launder(reinterpret_cast<const CallFrame *>(storage));
+        }
+
+        const Segment *const previous;
+        alignas(CallFrame)
+            std::byte storage[SEGMENT_FRAMES * sizeof(CallFrame)];
+    };
+    // Frames are never destroyed, only overwritten.
+    static_assert(std::is_trivially_destructible_v<CallFrame>);
+
+    void enter_segment(size_t index);
+    void next_segment();
+    void previous_segment();
+
+    std::vector<std::unique_ptr<Segment>> segments;
+    // Index of the segment holding the top frame, and its bounds. The current
+    // segment is only empty if the whole stack is.
+    size_t current;
+    std::atomic<const Segment *> current_segment;
+    CallFrame *segment_begin;
+    CallFrame *segment_end;
+    // Where the current segment ends or the stack is full, whichever is
+    // first.
+    CallFrame *limit;
+    // One past the top frame.
+    std::atomic<CallFrame *> top;
+    size_t max_frames;
+};
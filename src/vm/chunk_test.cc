@@ -21,4 +21,20 @@ TEST(ChunkTests, TestLineData) {
         int line = chunk.get_line(instruction);
         EXPECT_EQ(line, instruction / 2 + 1);
     }
-}
\ No newline at end of file
+}
+TEST(ChunkTests, TestTruncate) {
+    Chunk chunk;
+    for (int line = 1; line <= 3; ++line) {
+        chunk.write(OpCode::NIL, line);
+        chunk.write(OpCode::POP, line);
+    }
+    EXPECT_EQ(chunk.get_line(5), 3);
+
+    chunk.truncate(3);
+    EXPECT_EQ(chunk.code.size(), 3);
+    EXPECT_EQ(chunk.get_line(2), 2);
+
+    chunk.write(OpCode::POP, 4);
+    EXPECT_EQ(chunk.get_line(2), 2);
+    EXPECT_EQ(chunk.get_line(3), 4);
+}
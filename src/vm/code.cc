@@ -1,5 +1,6 @@
 #include "code.h"
 
+#include <algorithm>
 #include <stdexcept>
 
 InstructionData::InstructionData(OpCode opcode) : opcode(opcode) {}
@@ -12,6 +13,11 @@ void CodeChunk::write(InstructionData instruction_data, int line) {
     lines.add_line(line);
 }
 
+void CodeChunk::truncate(int size) {
+    lines.remove_last(code.size() - size);
+    code.erase(code.begin() + size, code.end());
+}
+
 int CodeChunk::get_line(int instruction) { return lines.get_line(instruction); }
 
 const jump_off_t &CodeChunk::jump_at(int offset) const {
@@ -22,6 +28,24 @@ jump_off_t &CodeChunk::jump_at(int offset) {
     return *as_jump_ptr(&code[offset]);
 }
 
+const global_ref_t &CodeChunk::global_at(int offset) const {
+    return *as_global_ptr(&code[offset]);
+}
+
+global_ref_t &CodeChunk::global_at(int offset) {
+    return *as_global_ptr(&code[offset]);
+}
+
+const wide_ref_t &CodeChunk::wide_at(int offset) const {
+    return *as_wide_ptr(&code[offset]);
+}
+
+wide_ref_t &CodeChunk::wide_at(int offset) {
+    return *as_wide_ptr(&code[offset]);
+}
+
+const CodeChunk::LineData &CodeChunk::line_data() const { return lines; }
+
 CodeChunk::LineData::LineData()
     : lines(), last_line_index(0), last_instruction(-1) {}
 
@@ -46,6 +70,21 @@ void CodeChunk::LineData::add_line(int line) {
     }
 }
 
+void CodeChunk::LineData::remove_last(int count) {
+    while (count > 0) {
+        auto &[line, line_count] = lines.back();
+        int removed = std::min(count, line_count);
+        line_count -= removed;
+        count -= removed;
+        if (line_count == 0) {
+            lines.pop_back();
+        }
+    }
+    // The cached instruction might not exist anymore.
+    last_line_index = 0;
+    last_instruction = -1;
+}
+
 int CodeChunk::LineData::get_line(int instruction) {
     int curr_instruction;
     size_t index;
@@ -6,41 +6,72 @@
 #include <utility>
 #include <vector>
 
+/** X-macro listing every opcode, in encoding order. Used to keep the `OpCode`
+ * enum and tables indexed by it (e.g. the VM dispatch table) in sync.
+ */
+#define LOX_OPCODES(X)                                                         \
+    X(CONSTANT)                                                                \
+    X(NIL)                                                                     \
+    X(TRUE)                                                                    \
+    X(FALSE)                                                                   \
+    X(EQUAL)                                                                   \
+    X(GREATER)                                                                 \
+    X(LESS)                                                                    \
+    X(ADD)                                                                     \
+    X(SUBTRACT)                                                                \
+    X(MULTIPLY)                                                                \
+    X(DIVIDE)                                                                  \
+    X(NOT)                                                                     \
+    X(NEGATE)                                                                  \
+    X(POP)                                                                     \
+    X(DEFINE_GLOBAL)                                                           \
+    X(SET_GLOBAL)                                                              \
+    X(GET_GLOBAL)                                                              \
+    X(SET_LOCAL)                                                               \
+    X(GET_LOCAL)                                                               \
+    X(SET_UPVALUE)                                                             \
+    X(GET_UPVALUE)                                                             \
+    X(PRINT)                                                                   \
+    X(JUMP)                                                                    \
+    X(JUMP_IF_FALSE)                                                           \
+    X(JUMP_IF_TRUE)                                                            \
+    X(LOOP)                                                                    \
+    X(CALL)                                                                    \
+    /* CALL replacing the caller's frame. Always followed by RETURN, which */  \
+    /* returns the result of calls that don't replace it (e.g. natives). */    \
+    X(TAIL_CALL)                                                               \
+    X(CLOSURE)                                                                 \
+    X(CLOSE_UPVALUE)                                                           \
+    X(RETURN)                                                                  \
+    /* Superinstructions, only emitted by the peephole optimizer. */           \
+    X(NOT_EQUAL)                                                               \
+    X(GREATER_EQUAL)                                                           \
+    X(LESS_EQUAL)                                                              \
+    X(POPN)                                                                    \
+    X(JUMP_IF_FALSE_POP)                                                       \
+    X(JUMP_IF_NOT_LESS)                                                        \
+    X(JUMP_IF_NOT_GREATER)                                                     \
+    X(ADD_LOCAL_CONST)                                                         \
+    /* Prefix: the next instruction's constant or jump operand is a */         \
+    /* `wide_ref_t`. Only used where the compact operand doesn't fit. */       \
+    X(WIDE)
+
 enum struct OpCode : int8_t {
-    CONSTANT,
-    NIL,
-    TRUE,
-    FALSE,
-    EQUAL,
-    GREATER,
-    LESS,
-    ADD,
-    SUBTRACT,
-    MULTIPLY,
-    DIVIDE,
-    NOT,
-    NEGATE,
-    POP,
-    DEFINE_GLOBAL,
-    SET_GLOBAL,
-    GET_GLOBAL,
-    SET_LOCAL,
-    GET_LOCAL,
-    SET_UPVALUE,
-    GET_UPVALUE,
-    PRINT,
-    JUMP,
-    JUMP_IF_FALSE,
-    JUMP_IF_TRUE,
-    LOOP,
-    CALL,
-    CLOSURE,
-    CLOSE_UPVALUE,
-    RETURN
+#define OPCODE_ENUM(op) op,
+    LOX_OPCODES(OPCODE_ENUM)
+#undef OPCODE_ENUM
 };
 
+constexpr int OPCODE_COUNT = 0
+#define OPCODE_ONE(op) +1
+    LOX_OPCODES(OPCODE_ONE)
+#undef OPCODE_ONE
+    ;
+
 using const_ref_t = uint8_t;
 using jump_off_t = uint16_t;
+using global_ref_t = uint16_t;
+using wide_ref_t = uint32_t;
 
 union InstructionData {
     OpCode opcode;
@@ -63,6 +94,32 @@ jump_off_t get_jump_off(const PtrT &it) {
     return *as_jump_ptr(&(*it));
 }
 
+inline const global_ref_t *as_global_ptr(const InstructionData *code_ptr) {
+    return reinterpret_cast<const global_ref_t *>(code_ptr);
+}
+
+inline global_ref_t *as_global_ptr(InstructionData *code_ptr) {
+    return reinterpret_cast<global_ref_t *>(code_ptr);
+}
+
+template <typename PtrT>
+global_ref_t get_global_ref(const PtrT &it) {
+    return *as_global_ptr(&(*it));
+}
+
+inline const wide_ref_t *as_wide_ptr(const InstructionData *code_ptr) {
+    return reinterpret_cast<const wide_ref_t *>(code_ptr);
+}
+
+inline wide_ref_t *as_wide_ptr(InstructionData *code_ptr) {
+    return reinterpret_cast<wide_ref_t *>(code_ptr);
+}
+
+template <typename PtrT>
+wide_ref_t get_wide_ref(const PtrT &it) {
+    return *as_wide_ptr(&(*it));
+}
+
 using CodeVec = std::vector<InstructionData>;
 
 /** A code chunk is a chunk that holds just code, and the line numbers they
@@ -80,17 +137,26 @@ struct CodeChunk {
     virtual ~CodeChunk() = default;
 
     void write(InstructionData instruction_data, int line);
+    /** Remove all code from `size` onwards. */
+    void truncate(int size);
 
     int get_line(int instruction);
 
     const jump_off_t &jump_at(int offset) const;
     jump_off_t &jump_at(int offset);
 
+    const global_ref_t &global_at(int offset) const;
+    global_ref_t &global_at(int offset);
+
+    const wide_ref_t &wide_at(int offset) const;
+    wide_ref_t &wide_at(int offset);
+
     struct LineData {
         LineData();
 
         // Assume monotonicity of lines.
         void add_line(int line);
+        void remove_last(int count);
         int get_line(int instruction);
 
         std::vector<std::pair<int, int>> lines;
@@ -100,6 +166,8 @@ struct CodeChunk {
         size_t last_line_index;
         int last_instruction;
     };
+    const LineData &line_data() const;
+
     CodeVec code;
 
   private:
@@ -0,0 +1,176 @@
+#include "compile_cache.h"
+
+#include "src/vm/bytecode_file.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fmt/format.h>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+/** FNV-1a, since `std::hash` may differ between builds sharing a cache. */
+uint64_t source_hash(std::string_view source) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char c : source) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/** A unique name next to `path`, to write to before renaming it to `path`. */
+fs::path temp_path(const fs::path &path) {
+    fs::path temp = path;
+    temp += fmt::format(".{}.tmp", getpid());
+    return temp;
+}
+
+} // namespace
+
+CompileCache::CompileCache(fs::path directory, uintmax_t max_bytes)
+    : directory(std::move(directory)), max_bytes(max_bytes) {}
+
+std::optional<CompileCache> CompileCache::from_environment() {
+    if (const char *directory = std::getenv("LOX_CACHE_DIR")) {
+        if (*directory == '\0') {
+            return std::nullopt;
+        }
+        return CompileCache(directory);
+    }
+    if (const char *cache_home = std::getenv("XDG_CACHE_HOME");
+        cache_home != nullptr and *cache_home != '\0') {
+        return CompileCache(fs::path(cache_home) / "cpplox");
+    }
+    if (const char *home = std::getenv("HOME");
+        home != nullptr and *home != '\0') {
+        return CompileCache(fs::path(home) / ".cache" / "cpplox");
+    }
+    return std::nullopt;
+}
+
+std::optional<heap_ptr<ObjFunction>>
+CompileCache::load(std::string_view source, HeapManager &heap_manager,
+                   Globals &globals) {
+    fs::path path = entry_path(source);
+    // A corrupt entry is just a miss, and is overwritten by the next store.
+    auto script = load_bytecode(path.string(), heap_manager, globals,
+                                /*report_errors=*/false);
+    if (!script.has_value()) {
+        update_stats(&Stats::misses);
+        return std::nullopt;
+    }
+    // The modification time is the entry's last use, for eviction.
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+    update_stats(&Stats::hits);
+    return script;
+}
+
+void CompileCache::store(std::string_view source, heap_ptr<ObjFunction> script,
+                         const Globals &globals) {
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (error) {
+        return;
+    }
+    fs::path path = entry_path(source);
+    fs::path temp = temp_path(path);
+    std::ofstream out(temp, std::ios::binary);
+    write_bytecode(out, script, globals);
+    out.close();
+    if (out) {
+        fs::rename(temp, path, error);
+    }
+    if (!out or error) {
+        fs::remove(temp, error);
+        return;
+    }
+    evict();
+}
+
+CompileCache::Stats CompileCache::stats() const {
+    Stats stats;
+    std::ifstream in(directory / "stats");
+    in >> stats.hits >> stats.misses >> stats.evictions;
+    // A missing or corrupt file counts from zero.
+    return in ? stats : Stats{};
+}
+
+fs::path CompileCache::entry_path(std::string_view source) const {
+    return directory / fmt::format("{:016x}-{}-v{}.loxc", source_hash(source),
+                                   source.size(), BYTECODE_VERSION);
+}
+
+void CompileCache::update_stats(uint64_t Stats::*counter, uint64_t count) {
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (error) {
+        return;
+    }
+    // Concurrent runs may lose each other's updates, but never corrupt the
+    // file.
+    Stats updated = stats();
+    updated.*counter += count;
+    fs::path path = directory / "stats";
+    fs::path temp = temp_path(path);
+    std::ofstream out(temp);
+    out << updated.hits << ' ' << updated.misses << ' ' << updated.evictions
+        << '\n';
+    out.close();
+    if (out) {
+        fs::rename(temp, path, error);
+    }
+    if (!out or error) {
+        fs::remove(temp, error);
+    }
+}
+
+void CompileCache::evict() {
+    struct Entry {
+        fs::file_time_type last_use;
+        uintmax_t size;
+        fs::path path;
+    };
+    std::vector<Entry> entries;
+    uintmax_t total_size = 0;
+    std::error_code error;
+    for (const fs::directory_entry &file :
+         fs::directory_iterator(directory, error)) {
+        if (file.path().extension() != ".loxc") {
+            continue;
+        }
+        uintmax_t size = file.file_size(error);
+        fs::file_time_type last_use = file.last_write_time(error);
+        if (error) {
+            continue;
+        }
+        entries.push_back(Entry{last_use, size, file.path()});
+        total_size += size;
+    }
+    if (total_size <= max_bytes) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) {
+                  return a.last_use < b.last_use;
+              });
+    uint64_t evicted = 0;
+    for (const Entry &entry : entries) {
+        if (total_size <= max_bytes) {
+            break;
+        }
+        if (fs::remove(entry.path, error)) {
+            total_size -= entry.size;
+            ++evicted;
+        }
+    }
+    update_stats(&Stats::evictions, evicted);
+}
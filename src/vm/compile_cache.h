@@ -0,0 +1,60 @@
+#pragma once
+
+#include "src/vm/globals.h"
+#include "src/vm/heap_manager.h"
+#include "src/vm/obj_function.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+
+/** A directory of compiled scripts, keyed by a hash of their source and the
+ * bytecode version, so that running an unchanged script skips compilation.
+ *
+ * Entries are written atomically, so concurrent runs never see a partial
+ * entry. Using an entry marks it as recently used, and the least recently
+ * used entries are evicted when the directory grows past its size cap.
+ * Failures to read or write the cache are not errors: the script is just
+ * compiled.
+ */
+struct CompileCache {
+    // Counters of the cache, kept in the cache directory across runs.
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    static constexpr uintmax_t DEFAULT_MAX_BYTES = 64 << 20;
+
+    CompileCache(std::filesystem::path directory,
+                 uintmax_t max_bytes = DEFAULT_MAX_BYTES);
+
+    /** The cache in `$LOX_CACHE_DIR`, or else in `$XDG_CACHE_HOME/cpplox` or
+     * `~/.cache/cpplox`. Setting `LOX_CACHE_DIR` to an empty string disables
+     * caching.
+     */
+    static std::optional<CompileCache> from_environment();
+
+    /** The cached script compiled from `source`, if there is one. */
+    std::optional<heap_ptr<ObjFunction>> load(std::string_view source,
+                                              HeapManager &heap_manager,
+                                              Globals &globals);
+    /** Cache `script`, compiled from `source`, evicting old entries if the
+     * cache is over its size cap.
+     */
+    void store(std::string_view source, heap_ptr<ObjFunction> script,
+               const Globals &globals);
+
+    Stats stats() const;
+
+    std::filesystem::path entry_path(std::string_view source) const;
+
+  private:
+    void update_stats(uint64_t Stats::*counter, uint64_t count = 1);
+    void evict();
+
+    std::filesystem::path directory;
+    uintmax_t max_bytes;
+};
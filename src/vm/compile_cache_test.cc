@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include "src/vm/compile_cache.h"
+#include "src/vm/vm.h"
+
+#include <filesystem>
+#include <string>
+
+namespace fs = std::filesystem;
+
+class CompileCacheTests : public testing::Test {
+  protected:
+    void SetUp() override {
+        const testing::TestInfo *test =
+            testing::UnitTest::GetInstance()->current_test_info();
+        directory = fs::temp_directory_path() / test->name();
+        fs::remove_all(directory);
+    }
+
+    void TearDown() override { fs::remove_all(directory); }
+
+    /** Run `source` through `cache` like `cpplox` does. */
+    InterpretResult run(CompileCache &cache, const std::string &source) {
+        VM vm{InterpretMode::FILE};
+        auto script =
+            cache.load(source, vm.get_heap_manager(), vm.get_globals());
+        if (!script.has_value()) {
+            script = compile(vm, source);
+            EXPECT_TRUE(script.has_value());
+            cache.store(source, script.value(), vm.get_globals());
+        }
+        return vm.run_script(script.value());
+    }
+
+    fs::path directory;
+};
+
+TEST_F(CompileCacheTests, TestSecondRunHits) {
+    CompileCache cache{directory};
+    std::string source =
+        R"(var a = "cached"; if (a + "!" != "cached!") fail();)";
+    EXPECT_EQ(run(cache, source), InterpretResult::OK);
+    EXPECT_TRUE(fs::exists(cache.entry_path(source)));
+    EXPECT_EQ(run(cache, source), InterpretResult::OK);
+    EXPECT_EQ(run(cache, source + " "), InterpretResult::OK);
+
+    CompileCache::Stats stats = cache.stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.evictions, 0);
+}
+
+TEST_F(CompileCacheTests, TestCorruptEntryIsAMiss) {
+    CompileCache cache{directory};
+    std::string source = "var a = 1;";
+    EXPECT_EQ(run(cache, source), InterpretResult::OK);
+    fs::resize_file(cache.entry_path(source), 10);
+    EXPECT_EQ(run(cache, source), InterpretResult::OK);
+    EXPECT_EQ(run(cache, source), InterpretResult::OK);
+
+    CompileCache::Stats stats = cache.stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 2);
+}
+
+TEST_F(CompileCacheTests, TestLeastRecentlyUsedIsEvicted) {
+    std::string first = "var a = 1;";
+    std::string second = "var b = 2;";
+    std::string third = "var c = 3;";
+    // Room for two entries.
+    CompileCache probe{directory};
+    EXPECT_EQ(run(probe, first), InterpretResult::OK);
+    uintmax_t size = fs::file_size(probe.entry_path(first));
+    CompileCache cache{directory, 2 * size + size / 2};
+
+    EXPECT_EQ(run(cache, second), InterpretResult::OK);
+    // As if `first` was used after `second` was stored. Timestamps are too
+    // coarse to just run it again.
+    fs::last_write_time(cache.entry_path(second),
+                        fs::last_write_time(cache.entry_path(first)) -
+                            std::chrono::seconds(1));
+    EXPECT_EQ(run(cache, third), InterpretResult::OK);
+
+    EXPECT_TRUE(fs::exists(cache.entry_path(first)));
+    EXPECT_FALSE(fs::exists(cache.entry_path(second)));
+    EXPECT_TRUE(fs::exists(cache.entry_path(third)));
+    EXPECT_EQ(cache.stats().evictions, 1);
+}
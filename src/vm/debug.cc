@@ -3,8 +3,9 @@
 #include "src/vm/obj_function.h"
 #include <fmt/format.h>
 #include <iostream>
+#include <sstream>
 
-void disassemble_chunk(Chunk &chunk, const std::string &name) {
+void disassemble_chunk(Chunk &chunk, std::string_view name) {
     std::cout << fmt::format("== {} ==\n", name);
     for (int offset = 0; offset < static_cast<int>(chunk.code.size());) {
         offset = disassemble_instruction(chunk, offset);
@@ -29,6 +30,13 @@ int byte_instruction(const std::string &name, Chunk &chunk, int offset) {
     return offset + 2;
 }
 
+int global_instruction(const std::string &name, const Chunk &chunk,
+                       int offset) {
+    global_ref_t slot = chunk.global_at(offset + 1);
+    std::cout << fmt::format("{:16s} {:4d}\n", name, slot);
+    return offset + 1 + sizeof(global_ref_t);
+}
+
 int jump_instruction(const std::string &name, int sign, const Chunk &chunk,
                      int offset) {
     jump_off_t jump = chunk.jump_at(offset + 1);
@@ -37,6 +45,65 @@ int jump_instruction(const std::string &name, int sign, const Chunk &chunk,
     return offset + 3;
 }
 
+int local_constant_instruction(const std::string &name, Chunk &chunk,
+                               int offset) {
+    const_ref_t slot = chunk.code[offset + 1].constant_ref;
+    const_ref_t constant = chunk.code[offset + 2].constant_ref;
+    std::cout << fmt::format("{:16s} {:4d} {:4d} '", name, slot, constant);
+    std::cout << chunk.constants[constant] << "'\n";
+    return offset + 3;
+}
+
+/** Prints a closure of the function at `constant`, whose captured upvalues
+ * start at `offset`. */
+int closure_instruction(const std::string &name, Chunk &chunk,
+                        wide_ref_t constant, int offset) {
+    std::cout << fmt::format("{:16s} {:4d} ", name, constant);
+    std::cout << chunk.constants[constant];
+    std::cout << "\n";
+
+    heap_ptr<ObjFunction> function = chunk.constants[constant].as_function();
+
+    for (const_ref_t j = 0; j < function->upvalue_count; ++j) {
+        bool is_local = chunk.code[offset++].constant_ref;
+        const_ref_t index = chunk.code[offset++].constant_ref;
+        std::cout << fmt::format("{:04d}    |                     {} {}\n",
+                                 offset - 2, is_local ? "local" : "upvalue",
+                                 index);
+    }
+    return offset;
+}
+
+int wide_instruction(Chunk &chunk, int offset) {
+    static const char *const names[] = {
+#define OPCODE_NAME(op) #op,
+        LOX_OPCODES(OPCODE_NAME)
+#undef OPCODE_NAME
+    };
+
+    OpCode instruction = chunk.code[offset + 1].opcode;
+    std::string name =
+        fmt::format("WIDE {}", names[static_cast<int>(instruction)]);
+    wide_ref_t operand = chunk.wide_at(offset + 2);
+    int next = offset + 2 + sizeof(wide_ref_t);
+    switch (instruction) {
+    case OpCode::CONSTANT:
+        std::cout << fmt::format("{:16s} {:4d} '", name, operand);
+        std::cout << chunk.constants[operand] << "'\n";
+        return next;
+    case OpCode::CLOSURE:
+        return closure_instruction(name, chunk, operand, next);
+    case OpCode::LOOP:
+        std::cout << fmt::format("{:16s} {:4d} -> {:d}\n", name, offset,
+                                 next - operand);
+        return next;
+    default:
+        std::cout << fmt::format("{:16s} {:4d} -> {:d}\n", name, offset,
+                                 next + operand);
+        return next;
+    }
+}
+
 int disassemble_instruction(Chunk &chunk, int offset) {
     std::cout << fmt::format("{:04d} ", offset);
     if (offset > 0 and chunk.get_line(offset - 1) == chunk.get_line(offset)) {
@@ -51,15 +118,15 @@ int disassemble_instruction(Chunk &chunk, int offset) {
     case OpCode::CONSTANT:
         return constant_instruction("CONSTANT", chunk, offset);
     case OpCode::DEFINE_GLOBAL:
-        return constant_instruction("DEFINE_GLOBAL", chunk, offset);
+        return global_instruction("DEFINE_GLOBAL", chunk, offset);
     case OpCode::GET_LOCAL:
         return byte_instruction("GET_LOCAL", chunk, offset);
     case OpCode::SET_LOCAL:
         return byte_instruction("SET_LOCAL", chunk, offset);
     case OpCode::GET_GLOBAL:
-        return constant_instruction("GET_GLOBAL", chunk, offset);
+        return global_instruction("GET_GLOBAL", chunk, offset);
     case OpCode::SET_GLOBAL:
-        return constant_instruction("SET_GLOBAL", chunk, offset);
+        return global_instruction("SET_GLOBAL", chunk, offset);
     case OpCode::GET_UPVALUE:
         return byte_instruction("GET_UPVALUE", chunk, offset);
     case OpCode::SET_UPVALUE:
@@ -102,30 +169,144 @@ int disassemble_instruction(Chunk &chunk, int offset) {
         return jump_instruction("LOOP", -1, chunk, offset);
     case OpCode::CALL:
         return byte_instruction("CALL", chunk, offset);
-    case OpCode::CLOSURE: {
-        offset++;
-        const_ref_t constant = chunk.code[offset++].constant_ref;
-        std::cout << fmt::format("{:16s} {:4d} ", "CLOSURE", constant);
-        std::cout << chunk.constants[constant];
-        std::cout << "\n";
-
-        heap_ptr<ObjFunction> function =
-            chunk.constants[constant].as_function();
-
-        for (const_ref_t j = 0; j < function->upvalue_count; ++j) {
-            bool is_local = chunk.code[offset++].constant_ref;
-            const_ref_t index = chunk.code[offset++].constant_ref;
-            std::cout << fmt::format("{:04d}    |                     {} {}\n",
-                                     offset - 2, is_local ? "local" : "upvalue",
-                                     index);
-        }
-        return offset;
-    }
+    case OpCode::TAIL_CALL:
+        return byte_instruction("TAIL_CALL", chunk, offset);
+    case OpCode::CLOSURE:
+        return closure_instruction("CLOSURE", chunk,
+                                   chunk.code[offset + 1].constant_ref,
+                                   offset + 2);
     case OpCode::CLOSE_UPVALUE:
         return simple_instruction("CLOSE_UPVALUE", offset);
+    case OpCode::NOT_EQUAL:
+        return simple_instruction("NOT_EQUAL", offset);
+    case OpCode::GREATER_EQUAL:
+        return simple_instruction("GREATER_EQUAL", offset);
+    case OpCode::LESS_EQUAL:
+        return simple_instruction("LESS_EQUAL", offset);
+    case OpCode::POPN:
+        return byte_instruction("POPN", chunk, offset);
+    case OpCode::JUMP_IF_FALSE_POP:
+        return jump_instruction("JUMP_IF_FALSE_POP", 1, chunk, offset);
+    case OpCode::JUMP_IF_NOT_LESS:
+        return jump_instruction("JUMP_IF_NOT_LESS", 1, chunk, offset);
+    case OpCode::JUMP_IF_NOT_GREATER:
+        return jump_instruction("JUMP_IF_NOT_GREATER", 1, chunk, offset);
+    case OpCode::ADD_LOCAL_CONST:
+        return local_constant_instruction("ADD_LOCAL_CONST", chunk, offset);
+    case OpCode::WIDE:
+        return wide_instruction(chunk, offset);
     default:
         std::cout << fmt::format("Unknown opcode {}\n",
                                  static_cast<int>(instruction));
         return offset + 1;
     }
 }
+
+std::string register_operand(const Chunk &chunk, reg_operand_t operand) {
+    if (!(operand & K_BIT)) {
+        return fmt::format("r{}", operand);
+    }
+    std::ostringstream constant;
+    constant << chunk.constants[operand & ~K_BIT];
+    return fmt::format("'{}'", constant.str());
+}
+
+void disassemble_register_code(const RegisterCode &code, const Chunk &chunk,
+                               std::string_view name) {
+    std::cout << fmt::format("== {} (registers: {}) ==\n", name,
+                             code.frame_size);
+    for (int index = 0; index < static_cast<int>(code.code.size());) {
+        index = disassemble_register_instruction(code, chunk, index);
+    }
+}
+
+int disassemble_register_instruction(const RegisterCode &code,
+                                     const Chunk &chunk, int index) {
+    static const char *const names[] = {
+#define REG_OPCODE_NAME(op) #op,
+        LOX_REG_OPCODES(REG_OPCODE_NAME)
+#undef REG_OPCODE_NAME
+    };
+
+    std::cout << fmt::format("{:04d} ", index);
+    if (index > 0 and code.lines[index - 1] == code.lines[index]) {
+        std::cout << "   | ";
+    } else {
+        std::cout << fmt::format("{:4d} ", code.lines[index]);
+    }
+    const RegInstruction &instruction = code.code[index];
+    auto rk = [&](reg_operand_t operand) {
+        return register_operand(chunk, operand);
+    };
+    std::string operands;
+    switch (instruction.opcode) {
+    case RegOpCode::NIL:
+    case RegOpCode::TRUE:
+    case RegOpCode::FALSE:
+    case RegOpCode::CLOSE_UPVALUE:
+        operands = fmt::format("r{}", instruction.a);
+        break;
+    case RegOpCode::MOVE:
+    case RegOpCode::NOT:
+    case RegOpCode::NEGATE:
+        operands = fmt::format("r{} {}", instruction.a, rk(instruction.b));
+        break;
+    case RegOpCode::DEFINE_GLOBAL:
+    case RegOpCode::SET_GLOBAL:
+        operands = fmt::format("g{} {}", instruction.a, rk(instruction.b));
+        break;
+    case RegOpCode::GET_GLOBAL:
+        operands = fmt::format("r{} g{}", instruction.a, instruction.b);
+        break;
+    case RegOpCode::SET_UPVALUE:
+        operands = fmt::format("u{} {}", instruction.a, rk(instruction.b));
+        break;
+    case RegOpCode::GET_UPVALUE:
+        operands = fmt::format("r{} u{}", instruction.a, instruction.b);
+        break;
+    case RegOpCode::PRINT:
+    case RegOpCode::RETURN:
+        operands = rk(instruction.b);
+        break;
+    case RegOpCode::JUMP:
+        operands = fmt::format("-> {}", index + 1 + instruction.wide_a());
+        break;
+    case RegOpCode::LOOP:
+        operands = fmt::format("-> {}", index + 1 - instruction.wide_a());
+        break;
+    case RegOpCode::JUMP_IF_FALSE:
+    case RegOpCode::JUMP_IF_TRUE:
+        operands = fmt::format("{} -> {}", rk(instruction.b),
+                               index + 1 + instruction.wide_a());
+        break;
+    case RegOpCode::JUMP_IF_NOT_LESS:
+    case RegOpCode::JUMP_IF_NOT_GREATER:
+        operands =
+            fmt::format("{} {} -> {}", rk(instruction.b), rk(instruction.c),
+                        index + 1 + instruction.wide_a());
+        break;
+    case RegOpCode::CALL:
+    case RegOpCode::TAIL_CALL:
+        operands = fmt::format("r{} {}", instruction.a, instruction.b);
+        break;
+    case RegOpCode::CLOSURE:
+    case RegOpCode::LOAD_CONSTANT: {
+        std::ostringstream constant;
+        constant << chunk.constants[instruction.wide_b()];
+        operands = fmt::format("r{} '{}'", instruction.a, constant.str());
+        break;
+    }
+    case RegOpCode::CAPTURE:
+        operands = instruction.a ? fmt::format("local r{}", instruction.b)
+                                 : fmt::format("upvalue {}", instruction.b);
+        break;
+    default:
+        operands = fmt::format("r{} {} {}", instruction.a, rk(instruction.b),
+                               rk(instruction.c));
+        break;
+    }
+    std::cout << fmt::format("{:16s} {}\n",
+                             names[static_cast<int>(instruction.opcode)],
+                             operands);
+    return index + 1;
+}
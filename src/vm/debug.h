@@ -1,8 +1,18 @@
 #pragma once
 
 #include "src/vm/chunk.h"
+#include "src/vm/register_code.h"
 
 #include <fmt/format.h>
+#include <string_view>
 
-void disassemble_chunk(Chunk &chunk, const std::string &name);
+void disassemble_chunk(Chunk &chunk, std::string_view name);
 int disassemble_instruction(Chunk &chunk, int offset);
+
+/** Disassemble register tier code. `chunk` is the stack code it was
+ * translated from, which holds the constants.
+ */
+void disassemble_register_code(const RegisterCode &code, const Chunk &chunk,
+                               std::string_view name);
+int disassemble_register_instruction(const RegisterCode &code,
+                                     const Chunk &chunk, int index);
@@ -0,0 +1,89 @@
+#include "gc_stats.h"
+
+#include <fmt/format.h>
+
+namespace {
+
+std::string live_to_json(const std::vector<gc::TypeStats> &live) {
+    std::string json = "{";
+    const char *separator = "";
+    for (size_t type = 0; type < live.size(); ++type) {
+        if (live[type].objects == 0) {
+            continue;
+        }
+        json += fmt::format(R"({}"{}": {{"objects": {}, "bytes": {}}})",
+                            separator, gc::type_name_at(type),
+                            live[type].objects, live[type].bytes);
+        separator = ", ";
+    }
+    return json + "}";
+}
+
+double milliseconds(std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+} // namespace
+
+std::string gc::stats_to_json(const Heap &heap) {
+    HeapStats totals = heap.stats();
+    std::string json = fmt::format(
+        "{{\n"
+        "  \"minor_collections\": {},\n"
+        "  \"major_collections\": {},\n"
+        "  \"total_pause_ns\": {},\n"
+        "  \"max_pause_ns\": {},\n"
+        "  \"allocated\": {},\n"
+        "  \"freed_bytes\": {},\n"
+        "  \"freed_objects\": {},\n"
+        "  \"live_bytes\": {},\n"
+        "  \"live\": {},\n"
+        "  \"next_gc\": {},\n"
+        "  \"growth_factor\": {},\n"
+        "  \"min_heap_size\": {},\n"
+        "  \"recent_cycles\": [",
+        totals.minor_collections, totals.major_collections,
+        totals.total_pause.count(), totals.max_pause.count(), totals.allocated,
+        totals.freed_bytes, totals.freed_objects, heap.get_bytes_allocated(),
+        live_to_json(heap.live_by_type()), heap.get_next_gc(),
+        heap.get_growth_factor(), heap.get_min_heap_size());
+    const char *separator = "\n";
+    for (const CycleStats &cycle : heap.recent_cycles()) {
+        json += fmt::format(
+            "{}    {{\"collection\": \"{}\", \"pause_ns\": {}, "
+            "\"allocated\": {}, \"freed_bytes\": {}, \"freed_objects\": {}, "
+            "\"live_bytes\": {}, \"live\": {}, \"next_gc\": {}}}",
+            separator,
+            cycle.collection == Collection::MINOR ? "minor" : "major",
+            cycle.pause.count(), cycle.allocated, cycle.freed_bytes,
+            cycle.freed_objects, cycle.live_bytes, live_to_json(cycle.live),
+            cycle.next_gc);
+        separator = ",\n";
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+void gc::print_summary(const Heap &heap, std::ostream &out) {
+    HeapStats totals = heap.stats();
+    out << fmt::format("gc: {} collections ({} minor, {} major), paused "
+                       "{:.3f} ms in total, {:.3f} ms at most\n",
+                       totals.minor_collections + totals.major_collections,
+                       totals.minor_collections, totals.major_collections,
+                       milliseconds(totals.total_pause),
+                       milliseconds(totals.max_pause));
+    out << fmt::format("gc: allocated {} bytes, freed {} bytes in {} "
+                       "objects\n",
+                       totals.allocated, totals.freed_bytes,
+                       totals.freed_objects);
+    out << fmt::format("gc: {} bytes live, next collection at {}\n",
+                       heap.get_bytes_allocated(), heap.get_next_gc());
+    std::vector<TypeStats> live = heap.live_by_type();
+    for (size_t type = 0; type < live.size(); ++type) {
+        if (live[type].objects > 0) {
+            out << fmt::format("gc:   {}: {} objects, {} bytes\n",
+                               type_name_at(type), live[type].objects,
+                               live[type].bytes);
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "src/vm/gc/heap.h"
+
+#include <ostream>
+#include <string>
+
+namespace gc {
+/** The stats of `heap` as a JSON object: the totals, the live objects by
+ * type, and the recent collections, oldest first.
+ */
+std::string stats_to_json(const Heap &heap);
+
+/** Print a few lines summarizing the collections of `heap`, and what is left
+ * on it.
+ */
+void print_summary(const Heap &heap, std::ostream &out);
+}; // namespace gc
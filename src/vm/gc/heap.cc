@@ -1,12 +1,324 @@
 #include "heap.h"
 
-Heap::Heap() : objects{} {}
+#include <algorithm>
+#include <limits>
 
-Heap::~Heap() { delete_all(); }
+constexpr double DEFAULT_GROWTH_FACTOR = 2;
+constexpr size_t DEFAULT_MIN_HEAP_SIZE = 1024 * 1024;
+constexpr size_t DEFAULT_NURSERY_SIZE = 256 * 1024;
+constexpr size_t DEFAULT_SLICE_BUDGET = 1000;
+// Bytes allocated between two slices of an incremental collection.
+constexpr size_t SLICE_INTERVAL = 16 * 1024;
 
-void Heap::delete_all() {
-    while (!objects.empty()) {
-        delete objects.front();
-        objects.erase_after(objects.before_begin());
+Heap::Heap()
+    : pool{}, young(nullptr), old(nullptr), unswept(nullptr),
+      unswept_young(nullptr), remembered{},
+      gc_hook(std::nullopt), bytes_allocated(0), young_bytes(0),
+      nursery_size(DEFAULT_NURSERY_SIZE), next_minor_gc(DEFAULT_NURSERY_SIZE),
+      next_gc(DEFAULT_MIN_HEAP_SIZE), growth_factor(DEFAULT_GROWTH_FACTOR),
+      min_heap_size(DEFAULT_MIN_HEAP_SIZE), stress_major(false),
+      slice_budget(DEFAULT_SLICE_BUDGET), phase(gc::Phase::IDLE),
+      marking_gray(gc::Collection::MAJOR), totals(), recorded(),
+      old_live(), cycles(), unrecorded_pause(0), awaiting_pause(false) {}
+
+Heap::~Heap() {
+    delete_all(young);
+    delete_all(old);
+    delete_all(unswept);
+    delete_all(unswept_young);
+}
+
+void Heap::set_gc(gc::GCFunc collect_garbage) { gc_hook = collect_garbage; }
+
+void Heap::set_nursery_size(size_t nursery_size) {
+    this->nursery_size = nursery_size;
+    if (phase == gc::Phase::IDLE) {
+        next_minor_gc = nursery_size;
+    }
+}
+
+void Heap::set_slice_budget(size_t budget) { slice_budget = budget; }
+
+void Heap::set_growth_factor(double growth_factor) {
+    this->growth_factor = growth_factor;
+    update_next_gc();
+}
+
+void Heap::set_min_heap_size(size_t min_heap_size) {
+    this->min_heap_size = min_heap_size;
+    update_next_gc();
+}
+
+gc::Collection Heap::next_collection() {
+    if (phase != gc::Phase::IDLE) {
+        return gc::Collection::MINOR;
+    }
+    if constexpr (DEBUG_STRESS_GC) {
+        stress_major = !stress_major;
+        if (stress_major) {
+            return gc::Collection::MAJOR;
+        }
+    }
+    return bytes_allocated > next_gc ? gc::Collection::MAJOR
+                                     : gc::Collection::MINOR;
+}
+
+bool Heap::is_incremental() const { return slice_budget > 0; }
+
+gc::Phase Heap::get_phase() const { return phase; }
+
+gc::GrayStack &Heap::begin_marking() {
+    phase = gc::Phase::MARKING;
+    // No minor collections until marking is done: everything allocated
+    // meanwhile is black, and gets promoted by the major sweep.
+    next_minor_gc = std::numeric_limits<size_t>::max();
+    next_gc = bytes_allocated + SLICE_INTERVAL;
+    return marking_gray;
+}
+
+bool Heap::mark_slice() {
+    for (size_t traced = 0; traced < slice_budget; ++traced) {
+        if (marking_gray.empty()) {
+            break;
+        }
+        marking_gray.pop()->trace(marking_gray);
+    }
+    next_gc = bytes_allocated + SLICE_INTERVAL;
+    return marking_gray.empty();
+}
+
+gc::GrayStack &Heap::get_marking_gray() { return marking_gray; }
+
+void Heap::sweep_slice() {
+    if (sweep_unswept(slice_budget)) {
+        end_major();
+    } else {
+        next_gc = bytes_allocated + SLICE_INTERVAL;
+    }
+}
+
+void Heap::mark_remembered(gc::GrayStack &gray) {
+    if (gray.collection != gc::Collection::MINOR) {
+        return;
+    }
+    for (HeapData *object : remembered) {
+        object->trace(gray);
+    }
+}
+
+void Heap::trace_references(gc::GrayStack &gray) {
+    while (!gray.empty()) {
+        HeapData *object = gray.pop();
+        if constexpr (DEBUG_LOG_GC) {
+            std::cout << fmt::format("{:p} blacken\n",
+                                     static_cast<void *>(object));
+        }
+        object->trace(gray);
+    }
+}
+
+void Heap::sweep(gc::Collection collection) {
+    // Every young object is about to be freed or promoted, so no reference
+    // from old to young objects will be left.
+    for (HeapData *object : remembered) {
+        object->remembered = false;
+    }
+    remembered.clear();
+
+    if (collection == gc::Collection::MINOR) {
+        sweep_young();
+        return;
+    }
+
+    // Objects are moved to `old` as they are swept, so they are not swept
+    // twice.
+    unswept = old;
+    old = nullptr;
+    unswept_young = young;
+    young = nullptr;
+    young_bytes = 0;
+    if (phase == gc::Phase::MARKING) {
+        // Minor collections can run between slices of sweeping.
+        phase = gc::Phase::SWEEPING;
+        next_minor_gc = nursery_size;
+        next_gc = bytes_allocated + SLICE_INTERVAL;
+        return;
+    }
+    sweep_unswept(std::numeric_limits<size_t>::max());
+    end_major();
+}
+
+size_t Heap::get_bytes_allocated() const { return bytes_allocated; }
+
+size_t Heap::get_next_gc() const { return next_gc; }
+
+size_t Heap::get_young_bytes() const { return young_bytes; }
+
+void Heap::record_pause(std::chrono::nanoseconds pause) {
+    totals.max_pause = std::max(totals.max_pause, pause);
+    totals.total_pause += pause;
+    if (awaiting_pause) {
+        cycles.back().pause += pause;
+        awaiting_pause = false;
+    } else {
+        unrecorded_pause += pause;
+    }
+}
+
+std::chrono::nanoseconds Heap::get_max_pause() const {
+    return totals.max_pause;
+}
+
+const std::deque<gc::CycleStats> &Heap::recent_cycles() const {
+    return cycles;
+}
+
+gc::HeapStats Heap::stats() const {
+    gc::HeapStats stats = totals;
+    stats.allocated = bytes_allocated + totals.freed_bytes;
+    return stats;
+}
+
+std::vector<gc::TypeStats> Heap::live_by_type() const {
+    std::vector<gc::TypeStats> live = old_live;
+    live.resize(gc::type_count());
+    for (HeapData *objects : {young, unswept_young}) {
+        for (HeapData *object = objects; object != nullptr;
+             object = object->next) {
+            ++live[object->type].objects;
+            live[object->type].bytes += object->size();
+        }
+    }
+    return live;
+}
+
+double Heap::get_growth_factor() const { return growth_factor; }
+
+size_t Heap::get_min_heap_size() const { return min_heap_size; }
+
+std::vector<gc::Pool::ClassStats> Heap::pool_stats() const {
+    return pool.stats();
+}
+
+void Heap::grow(HeapData *object, size_t bytes) {
+    bytes_allocated += bytes;
+    if (object->old) {
+        old_live[object->type].bytes += bytes;
+    } else {
+        young_bytes += bytes;
+    }
+}
+
+void Heap::update_next_gc() {
+    next_gc = std::max(static_cast<size_t>(bytes_allocated * growth_factor),
+                       min_heap_size);
+}
+
+void Heap::sweep_young() {
+    while (young != nullptr) {
+        HeapData *object = young;
+        young = object->next;
+        if (!object->marked) {
+            size_t size = object->size();
+            bytes_allocated -= size;
+            count_freed(object, size);
+            free(object);
+            continue;
+        }
+        object->marked = false;
+        count_promoted(object);
+        object->old = true;
+        object->next = old;
+        old = object;
+    }
+    young_bytes = 0;
+    record_cycle(gc::Collection::MINOR);
+}
+
+bool Heap::sweep_unswept(size_t budget) {
+    size_t swept = 0;
+    for (HeapData **list : {&unswept, &unswept_young}) {
+        for (; swept < budget and *list != nullptr; ++swept) {
+            HeapData *object = *list;
+            *list = object->next;
+            if (!object->marked) {
+                size_t size = object->size();
+                bytes_allocated -= size;
+                count_freed(object, size);
+                free(object);
+                continue;
+            }
+            object->marked = false;
+            if (!object->old) {
+                count_promoted(object);
+            }
+            object->old = true;
+            object->next = old;
+            old = object;
+        }
+    }
+    return unswept == nullptr and unswept_young == nullptr;
+}
+
+void Heap::end_major() {
+    phase = gc::Phase::IDLE;
+    next_minor_gc = nursery_size;
+    update_next_gc();
+    record_cycle(gc::Collection::MAJOR);
+}
+
+void Heap::record_cycle(gc::Collection collection) {
+    if (collection == gc::Collection::MINOR) {
+        ++totals.minor_collections;
+    } else {
+        ++totals.major_collections;
+    }
+    if (cycles.size() == CYCLE_HISTORY) {
+        cycles.pop_front();
+    }
+    gc::HeapStats now = stats();
+    cycles.push_back({
+        .collection = collection,
+        .pause = unrecorded_pause,
+        .allocated = now.allocated - recorded.allocated,
+        .freed_bytes = now.freed_bytes - recorded.freed_bytes,
+        .freed_objects = now.freed_objects - recorded.freed_objects,
+        .live_bytes = bytes_allocated,
+        .live = live_by_type(),
+        .next_gc = next_gc,
+    });
+    recorded = now;
+    unrecorded_pause = std::chrono::nanoseconds(0);
+    awaiting_pause = true;
+}
+
+void Heap::count_freed(HeapData *object, size_t size) {
+    totals.freed_bytes += size;
+    ++totals.freed_objects;
+    if (object->old) {
+        old_live[object->type].bytes -= size;
+        --old_live[object->type].objects;
+    }
+}
+
+void Heap::count_promoted(HeapData *object) {
+    if (object->type >= old_live.size()) {
+        old_live.resize(object->type + 1);
+    }
+    ++old_live[object->type].objects;
+    old_live[object->type].bytes += object->size();
+}
+
+void Heap::free(HeapData *object) {
+    uint8_t size_class = object->size_class;
+    object->~HeapData();
+    pool.deallocate(object, size_class);
+}
+
+void Heap::delete_all(HeapData *objects) {
+    while (objects != nullptr) {
+        HeapData *object = objects;
+        objects = object->next;
+        free(object);
     }
 }
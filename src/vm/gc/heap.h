@@ -3,28 +3,222 @@
 #include "src/debug_flags.h"
 #include "src/util/type_name.h"
 #include "src/vm/gc/heap_obj.h"
+#include "src/vm/gc/pool.h"
+#include <chrono>
+#include <cstddef>
+#include <deque>
 #include <fmt/format.h>
-#include <forward_list>
+#include <functional>
 #include <iostream>
+#include <new>
+#include <optional>
 #include <utility>
+#include <vector>
+
+namespace gc {
+using GCFunc = std::function<void(void)>;
+
+/** What an incremental major collection is doing between slices. */
+enum struct Phase { IDLE, MARKING, SWEEPING };
+
+/** Live objects of one type, and the bytes accounted to them. */
+struct TypeStats {
+    size_t objects = 0;
+    size_t bytes = 0;
+};
+
+/** What one collection did. The slices of an incremental collection, and
+ * the work done between collections that interleave with it, are accounted
+ * to the next collection to finish.
+ */
+struct CycleStats {
+    Collection collection;
+    std::chrono::nanoseconds pause;
+    // Bytes allocated since the previous collection finished.
+    size_t allocated;
+    size_t freed_bytes;
+    size_t freed_objects;
+    size_t live_bytes;
+    // Indexed by `type_index`.
+    std::vector<TypeStats> live;
+    size_t next_gc;
+};
+
+/** Totals over the lifetime of a heap. */
+struct HeapStats {
+    size_t minor_collections = 0;
+    size_t major_collections = 0;
+    std::chrono::nanoseconds total_pause{0};
+    std::chrono::nanoseconds max_pause{0};
+    size_t allocated = 0;
+    size_t freed_bytes = 0;
+    size_t freed_objects = 0;
+};
+};
 
 struct Heap {
     Heap();
 
     template <typename T, typename... Args>
     heap_ptr<T> make(Args &&...args) {
-        HeapObj<T> *ptr = new HeapObj<T>(std::forward<Args>(args)...);
+        return make_sized<T>(0, std::forward<Args>(args)...);
+    }
+
+    /** Like `make`, with `extra_bytes` allocated after the object, for types
+     * ending in a flexible array member.
+     */
+    template <typename T, typename... Args>
+    heap_ptr<T> make_sized(size_t extra_bytes, Args &&...args) {
+        if (gc_hook and collection_due()) {
+            std::invoke(gc_hook.value());
+        }
+
+        static_assert(alignof(HeapObj<T>) <= gc::Pool::GRANULE);
+        size_t bytes = sizeof(HeapObj<T>) + extra_bytes;
+        uint8_t size_class = gc::Pool::size_class(bytes);
+        void *memory = pool.allocate(size_class, bytes);
+        HeapObj<T> *ptr;
+        try {
+            ptr = new (memory) HeapObj<T>(std::forward<Args>(args)...);
+        } catch (...) {
+            pool.deallocate(memory, size_class);
+            throw;
+        }
+        static const uint8_t type = gc::type_index(type_name<T>());
+        ptr->size_class = size_class;
+        ptr->type = type;
+        size_t size = ptr->size();
         if constexpr (DEBUG_LOG_GC) {
             std::cout << fmt::format("{:p} allocate {} for {}\n", fmt::ptr(ptr),
-                                     sizeof(ptr), type_name<T>());
+                                     size, type_name<T>());
         }
-        if (!ptr) {
-            return nullptr;
+        bytes_allocated += size;
+        young_bytes += size;
+        ptr->next = young;
+        young = ptr;
+        if (phase == gc::Phase::MARKING) {
+            // Allocate black, shading whatever the object was constructed
+            // with, so marking never has more than the initial heap to trace.
+            ptr->marked = true;
+            ptr->trace(marking_gray);
         }
-        objects.push_front(ptr);
         return ptr;
     }
 
+    /** Set the function called to collect garbage once enough was allocated.
+     * It should mark the roots for `next_collection()`, then call
+     * `mark_remembered`, `trace_references` and `sweep`. While an
+     * incremental collection is in progress, it should run its next slice
+     * instead.
+     */
+    void set_gc(gc::GCFunc collect_garbage);
+    /** A minor collection happens whenever `nursery_size` bytes were
+     * allocated since the last collection.
+     */
+    void set_nursery_size(size_t nursery_size);
+    /** Number of objects traced or swept by each slice of an incremental
+     * major collection. Zero makes major collections stop the world.
+     */
+    void set_slice_budget(size_t budget);
+    /** After a collection, the next one happens once the heap grows to
+     * `growth_factor` times its live size (but at least `min_heap_size`).
+     */
+    void set_growth_factor(double growth_factor);
+    void set_min_heap_size(size_t min_heap_size);
+
+    /** Account `bytes` more to `object`, whose `size()` just grew by as
+     * much.
+     */
+    void grow(HeapData *object, size_t bytes);
+
+    /** Whether enough was allocated since the last collection or slice. */
+    bool collection_due() const {
+        return DEBUG_STRESS_GC or young_bytes > next_minor_gc or
+               bytes_allocated > next_gc;
+    }
+    /** Whether the next collection should be minor or major. */
+    gc::Collection next_collection();
+
+    /** Must be called after storing `value` (a `Value` or a `heap_ptr`) into
+     * `owner`, so a minor collection finds young objects referenced only by
+     * old ones, and incremental marking never leaves a marked object
+     * referencing an unmarked one.
+     */
+    template <typename Stored>
+    void write_barrier(HeapData *owner, Stored value) {
+        // Marked objects that were not swept yet are live, and are skipped by
+        // minor collections just like old ones.
+        if ((owner->old or owner->marked) and !owner->remembered) {
+            owner->remembered = true;
+            remembered.push_back(owner);
+        }
+        // Only the stored value, since tracing the whole owner again would
+        // make filling a large object while marking quadratic.
+        if (phase == gc::Phase::MARKING and owner->marked) {
+            value.mark(marking_gray);
+        }
+    }
+    /** Mark `object` if incremental marking is in progress. For objects that
+     * the mutator reaches without going through a traced reference, such as
+     * interned strings.
+     */
+    void shade(HeapData *object) {
+        if (phase == gc::Phase::MARKING) {
+            object->mark(marking_gray);
+        }
+    }
+
+    bool is_incremental() const;
+    gc::Phase get_phase() const;
+    /** Start an incremental major collection. The roots should be marked into
+     * the returned gray stack.
+     */
+    gc::GrayStack &begin_marking();
+    /** Trace up to the slice budget of gray objects. Returns whether marking
+     * is done, in which case the roots should be marked again into
+     * `get_marking_gray()`, and the collection finished with `sweep`.
+     */
+    bool mark_slice();
+    gc::GrayStack &get_marking_gray();
+    /** Sweep up to the slice budget of old objects. */
+    void sweep_slice();
+
+    /** In a minor collection, trace the references of the remembered set. */
+    void mark_remembered(gc::GrayStack &gray);
+    /** Trace the references of gray objects until none are left. */
+    void trace_references(gc::GrayStack &gray);
+    /** Free the objects that don't survive `collection`, and promote the
+     * young survivors. All survivors are left unmarked. After incremental
+     * marking, objects are swept by later calls to `sweep_slice` instead.
+     */
+    void sweep(gc::Collection collection = gc::Collection::MAJOR);
+
+    size_t get_bytes_allocated() const;
+    size_t get_next_gc() const;
+    size_t get_young_bytes() const;
+
+    /** Record how long the mutator was stopped by a collection or slice. The
+     * pause is accounted to the last collection, if it finished since the
+     * previous pause was recorded, and otherwise to the next one.
+     */
+    void record_pause(std::chrono::nanoseconds pause);
+    /** The longest time the mutator was stopped by a collection or slice. */
+    std::chrono::nanoseconds get_max_pause() const;
+    /** Number of collections kept by `recent_cycles`. */
+    static constexpr size_t CYCLE_HISTORY = 64;
+    /** The last collections to finish, oldest first. */
+    const std::deque<gc::CycleStats> &recent_cycles() const;
+    gc::HeapStats stats() const;
+    /** Live objects by type, indexed by `type_index`. Objects that are
+     * unreachable but not freed yet count as live. Young objects are counted
+     * on each call, so allocating costs nothing more.
+     */
+    std::vector<gc::TypeStats> live_by_type() const;
+    double get_growth_factor() const;
+    size_t get_min_heap_size() const;
+    /** Occupancy of the pool's size classes. */
+    std::vector<gc::Pool::ClassStats> pool_stats() const;
+
     Heap(const Heap &) = delete;
     Heap &operator=(const Heap &) = delete;
     Heap(Heap &&) = delete;
@@ -33,7 +227,55 @@ struct Heap {
     ~Heap();
 
   private:
-    void delete_all();
+    void update_next_gc();
+    void sweep_young();
+    /** Sweep up to `budget` objects not swept yet by the current major
+     * collection. Returns whether it is done.
+     */
+    bool sweep_unswept(size_t budget);
+    void end_major();
+    void record_cycle(gc::Collection collection);
+    /** Count `object`, of `size` bytes, as freed by a collection. */
+    void count_freed(HeapData *object, size_t size);
+    void count_promoted(HeapData *object);
+    void free(HeapData *object);
+    void delete_all(HeapData *objects);
+
+    gc::Pool pool;
+    // Intrusive lists of objects allocated since the last collection, and of
+    // objects that survived one, linked through `HeapData::next`.
+    HeapData *young;
+    HeapData *old;
+    // Objects not swept yet by the current major collection.
+    HeapData *unswept;
+    HeapData *unswept_young;
+    // Old objects that may reference young objects.
+    std::vector<HeapData *> remembered;
+    std::optional<gc::GCFunc> gc_hook;
+
+    size_t bytes_allocated;
+    size_t young_bytes;
+    size_t nursery_size;
+    size_t next_minor_gc;
+    size_t next_gc;
+    double growth_factor;
+    size_t min_heap_size;
+    // Stress collections alternate between minor and major.
+    bool stress_major;
+
+    size_t slice_budget;
+    gc::Phase phase;
+    gc::GrayStack marking_gray;
 
-    std::forward_list<HeapData *> objects;
-};
\ No newline at end of file
+    // Bytes allocated is derived from these, when asked for.
+    gc::HeapStats totals;
+    // The totals when the last collection was recorded.
+    gc::HeapStats recorded;
+    // Old objects by type.
+    std::vector<gc::TypeStats> old_live;
+    std::deque<gc::CycleStats> cycles;
+    // Pauses of slices before the next collection finishes.
+    std::chrono::nanoseconds unrecorded_pause;
+    // Whether the last collection finished during the pause being recorded.
+    bool awaiting_pause;
+};
@@ -1,11 +1,74 @@
 #include "heap_obj.h"
 
-HeapData::HeapData() : marked(false) {}
+#include <stdexcept>
+#include <string>
 
-void HeapData::mark() { marked = true; }
+using namespace gc;
+
+namespace {
+
+std::vector<std::string_view> &type_names() {
+    static std::vector<std::string_view> names;
+    return names;
+}
+
+} // namespace
+
+uint8_t gc::type_index(std::string_view name) {
+    std::vector<std::string_view> &names = type_names();
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (names[i] == name) {
+            return i;
+        }
+    }
+    if (names.size() > UINT8_MAX) {
+        throw std::runtime_error("Too many types of heap objects.");
+    }
+    names.push_back(name);
+    return names.size() - 1;
+}
+
+std::string_view gc::type_name_at(uint8_t index) {
+    return type_names()[index];
+}
+
+size_t gc::type_count() { return type_names().size(); }
+
+GrayStack::GrayStack(Collection collection)
+    : collection(collection), objects() {}
+
+void GrayStack::push(HeapData *object) { objects.push_back(object); }
+
+HeapData *GrayStack::pop() {
+    HeapData *object = objects.back();
+    objects.pop_back();
+    return object;
+}
+
+bool GrayStack::empty() const { return objects.empty(); }
+
+HeapData::HeapData()
+    : marked(false), old(false), remembered(false), size_class(0), type(0),
+      next(nullptr) {}
+
+void HeapData::mark(GrayStack &gray) {
+    // Old objects are not traced in a minor collection. Their references to
+    // young objects are found through the remembered set instead.
+    if (marked or (old and gray.collection == Collection::MINOR)) {
+        return;
+    }
+    marked = true;
+    gray.push(this);
+}
 
 bool HeapData::is_marked() const { return marked; }
 
+bool HeapData::is_old() const { return old; }
+
+bool HeapData::survives(Collection collection) const {
+    return marked or (old and collection == Collection::MINOR);
+}
+
 void debug_test_size_heap_ptr() {
     if constexpr (DEBUG_SIZEOF_ASSERTS) {
 #ifndef __INTELLISENSE__
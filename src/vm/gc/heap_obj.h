@@ -3,24 +3,84 @@
 #include "src/debug_flags.h"
 #include "src/util/type_name.h"
 #include <cstddef>
+#include <cstdint>
 #include <fmt/format.h>
 #include <iostream>
+#include <string_view>
 #include <utility>
+#include <vector>
+
+struct HeapData;
+
+namespace gc {
+/** Index of the type of heap objects called `name`, registering it the first
+ * time it is asked for. Types are counted by the heap's stats.
+ */
+uint8_t type_index(std::string_view name);
+/** Name of the type of heap objects at `index`. */
+std::string_view type_name_at(uint8_t index);
+/** Number of types registered by `type_index`. */
+size_t type_count();
+
+/** A minor collection only frees young objects, and treats old objects as
+ * live. A major collection traces and frees the whole heap.
+ */
+enum struct Collection { MINOR, MAJOR };
+
+/** Objects that were marked but whose references were not traced yet. */
+struct GrayStack {
+    GrayStack(Collection collection = Collection::MAJOR);
+
+    void push(HeapData *object);
+    HeapData *pop();
+    bool empty() const;
+
+    const Collection collection;
+
+  private:
+    std::vector<HeapData *> objects;
+};
+}; // namespace gc
 
 struct HeapData {
     HeapData();
 
     virtual ~HeapData() = default;
 
-    void mark();
+    /** Mark the object, and queue it to have its references traced. */
+    void mark(gc::GrayStack &gray);
     bool is_marked() const;
+    /** Whether the object survived a collection, and was promoted. */
+    bool is_old() const;
+    /** Whether the object is kept by the collection that marked it. */
+    bool survives(gc::Collection collection) const;
+
+    /** Mark all objects referenced by this object. */
+    virtual void trace(gc::GrayStack &gray) = 0;
+    /** Bytes accounted to this object by the heap. May only change if the
+     * heap is told, with `Heap::grow`.
+     */
+    virtual size_t size() const = 0;
 
     friend class Heap;
 
   private:
     bool marked;
+    bool old;
+    // Whether the object is in the heap's remembered set.
+    bool remembered;
+    // Size class of the pool slot holding the object.
+    uint8_t size_class;
+    // Index of the object's type, for the heap's stats.
+    uint8_t type;
+    // Next object in the heap's list of all objects.
+    HeapData *next;
 };
 
+/** A type held on the heap may define `void trace(gc::GrayStack &)` to mark
+ * the objects it references, and `size_t heap_size() const` to account for
+ * memory it owns outside of the object itself.
+ */
 template <typename T>
 struct HeapObj : HeapData {
     template <typename... Args>
@@ -33,6 +93,20 @@ struct HeapObj : HeapData {
         }
     }
 
+    void trace(gc::GrayStack &gray) override {
+        if constexpr (requires { obj.trace(gray); }) {
+            obj.trace(gray);
+        }
+    }
+
+    size_t size() const override {
+        if constexpr (requires { obj.heap_size(); }) {
+            return sizeof(HeapObj<T>) + obj.heap_size();
+        } else {
+            return sizeof(HeapObj<T>);
+        }
+    }
+
     T obj;
 };
 
@@ -52,11 +126,11 @@ struct heap_ptr {
     bool operator==(heap_ptr<T> other) { return ptr == other.ptr; }
     bool operator==(nullptr_t other) { return ptr == other; }
 
-    void mark() {
+    void mark(gc::GrayStack &gray) {
         if (ptr == nullptr) {
             return;
         }
-        ptr->mark();
+        ptr->mark(gray);
     }
 
     // Note we don't delete ptr here.
@@ -70,4 +144,4 @@ struct heap_ptr {
 };
 
 // if debug flag is on, asserts that sizeof(heap_ptr) == sizeof(void*)
-void debug_test_size_heap_ptr();
\ No newline at end of file
+void debug_test_size_heap_ptr();
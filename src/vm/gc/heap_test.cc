@@ -2,7 +2,9 @@
 
 #include "src/vm/gc/heap.h"
 #include "src/vm/gc/heap_obj.h"
+#include <cstring>
 #include <string>
+#include <vector>
 
 struct A {
     int x;
@@ -16,4 +18,256 @@ TEST(HeapTests, TestAll) {
     auto q = heap.make<A>(10);
 
     std::cout << *p2 + *p << q->x << std::endl;
-}
\ No newline at end of file
+}
+struct Node {
+    Node(heap_ptr<Node> next) : next(next) {}
+
+    void trace(gc::GrayStack &gray) { next.mark(gray); }
+
+    heap_ptr<Node> next;
+};
+
+TEST(HeapTests, TestCollectUnreachable) {
+    Heap heap{};
+    auto tail = heap.make<Node>(nullptr);
+    auto head = heap.make<Node>(tail);
+    heap.make<Node>(head);
+    size_t node_size = heap.get_bytes_allocated() / 3;
+
+    // Only `head` is a root; it keeps `tail` alive through its reference.
+    gc::GrayStack gray;
+    head.mark(gray);
+    heap.trace_references(gray);
+    heap.sweep();
+    EXPECT_EQ(heap.get_bytes_allocated(), 2 * node_size);
+    EXPECT_FALSE(head.get()->is_marked());
+    EXPECT_FALSE(tail.get()->is_marked());
+
+    heap.sweep();
+    EXPECT_EQ(heap.get_bytes_allocated(), 0);
+}
+
+TEST(HeapTests, TestCollectOnAllocation) {
+    Heap heap{};
+    heap.set_growth_factor(2);
+    heap.set_min_heap_size(0);
+
+    int collections = 0;
+    heap.set_gc([&]() {
+        ++collections;
+        heap.sweep();
+    });
+
+    // Every allocation is garbage, so collections free everything.
+    for (int i = 0; i < 100; ++i) {
+        heap.make<A>(i);
+    }
+    EXPECT_GT(collections, 0);
+    EXPECT_LE(heap.get_bytes_allocated(), 2 * sizeof(HeapObj<A>));
+}
+
+TEST(HeapTests, TestPoolReusesFreedSlots) {
+    Heap heap{};
+    for (int i = 0; i < 1000; ++i) {
+        heap.make<A>(i);
+    }
+    auto stats = heap.pool_stats();
+    ASSERT_EQ(stats.size(), 1);
+    EXPECT_EQ(stats[0].slots_used, 1000);
+    size_t blocks = stats[0].blocks;
+
+    heap.sweep();
+    EXPECT_EQ(heap.pool_stats()[0].slots_used, 0);
+
+    // Freed slots are reused before any new block is carved.
+    for (int i = 0; i < 1000; ++i) {
+        heap.make<A>(i);
+    }
+    EXPECT_EQ(heap.pool_stats()[0].blocks, blocks);
+}
+
+struct Bytes {
+    Bytes(size_t count) : count(count) { std::memset(bytes, 'x', count); }
+
+    size_t heap_size() const { return count; }
+
+    size_t count;
+    char bytes[];
+};
+
+TEST(HeapTests, TestMakeSized) {
+    Heap heap{};
+    auto small = heap.make_sized<Bytes>(100, 100);
+    size_t small_size = sizeof(HeapObj<Bytes>) + 100;
+    EXPECT_EQ(heap.get_bytes_allocated(), small_size);
+    auto stats = heap.pool_stats();
+    ASSERT_EQ(stats.size(), 1);
+    EXPECT_GE(stats[0].slot_size, small_size);
+    EXPECT_EQ(small->bytes[99], 'x');
+
+    // Too large for any size class.
+    heap.make_sized<Bytes>(1000, 1000);
+    EXPECT_EQ(heap.get_bytes_allocated(),
+              small_size + sizeof(HeapObj<Bytes>) + 1000);
+
+    heap.sweep();
+    EXPECT_EQ(heap.get_bytes_allocated(), 0);
+}
+
+void collect(Heap &heap, gc::Collection collection,
+             std::initializer_list<heap_ptr<Node>> roots) {
+    gc::GrayStack gray{collection};
+    for (auto root : roots) {
+        root.mark(gray);
+    }
+    heap.mark_remembered(gray);
+    heap.trace_references(gray);
+    heap.sweep(collection);
+}
+
+TEST(HeapTests, TestMinorCollectionPromotes) {
+    Heap heap{};
+    auto survivor = heap.make<Node>(nullptr);
+    heap.make<Node>(nullptr);
+    size_t node_size = heap.get_bytes_allocated() / 2;
+
+    collect(heap, gc::Collection::MINOR, {survivor});
+    EXPECT_TRUE(survivor.get()->is_old());
+    EXPECT_EQ(heap.get_bytes_allocated(), node_size);
+    EXPECT_EQ(heap.get_young_bytes(), 0);
+
+    // Old objects are only freed by a major collection.
+    collect(heap, gc::Collection::MINOR, {});
+    EXPECT_EQ(heap.get_bytes_allocated(), node_size);
+    collect(heap, gc::Collection::MAJOR, {});
+    EXPECT_EQ(heap.get_bytes_allocated(), 0);
+}
+
+TEST(HeapTests, TestWriteBarrierKeepsYoungObjects) {
+    Heap heap{};
+    auto parent = heap.make<Node>(nullptr);
+    collect(heap, gc::Collection::MINOR, {parent});
+
+    // `parent` is old and no root refers to `child`.
+    auto child = heap.make<Node>(nullptr);
+    parent->next = child;
+    heap.write_barrier(parent.get(), child);
+    size_t before = heap.get_bytes_allocated();
+
+    collect(heap, gc::Collection::MINOR, {});
+    EXPECT_EQ(heap.get_bytes_allocated(), before);
+    EXPECT_TRUE(child.get()->is_old());
+}
+
+TEST(HeapTests, TestIncrementalMarking) {
+    Heap heap{};
+    heap.set_slice_budget(1);
+    auto tail = heap.make<Node>(nullptr);
+    auto middle = heap.make<Node>(tail);
+    auto head = heap.make<Node>(middle);
+    auto orphan = heap.make<Node>(nullptr);
+    heap.make<Node>(nullptr);
+    size_t node_size = heap.get_bytes_allocated() / 5;
+
+    head.mark(heap.begin_marking());
+    EXPECT_EQ(heap.get_phase(), gc::Phase::MARKING);
+    EXPECT_FALSE(heap.mark_slice());
+
+    // `head` was traced already, so the barrier must mark `orphan`.
+    head->next = orphan;
+    heap.write_barrier(head.get(), orphan);
+    while (!heap.mark_slice()) {
+    }
+
+    // Objects allocated while marking are black.
+    auto late = heap.make<Node>(nullptr);
+    EXPECT_TRUE(late.get()->is_marked());
+
+    heap.trace_references(heap.get_marking_gray());
+    heap.sweep();
+    EXPECT_EQ(heap.get_phase(), gc::Phase::SWEEPING);
+    while (heap.get_phase() == gc::Phase::SWEEPING) {
+        heap.sweep_slice();
+    }
+    EXPECT_EQ(heap.get_bytes_allocated(), 5 * node_size);
+}
+
+struct Wide {
+    void trace(gc::GrayStack &gray) {
+        ++traces;
+        for (heap_ptr<Node> &child : children) {
+            child.mark(gray);
+        }
+    }
+
+    std::vector<heap_ptr<Node>> children;
+    int traces = 0;
+};
+
+TEST(HeapTests, TestWriteBarrierDoesNotRetraceOwner) {
+    Heap heap{};
+    std::vector<heap_ptr<Node>> children;
+    for (int i = 0; i < 1000; ++i) {
+        children.push_back(heap.make<Node>(nullptr));
+    }
+    auto owner = heap.make<Wide>();
+    owner.mark(heap.begin_marking());
+    while (!heap.mark_slice()) {
+    }
+    ASSERT_EQ(owner->traces, 1);
+
+    // Filling a traced object only shades what is stored in it.
+    for (heap_ptr<Node> &child : children) {
+        owner->children.push_back(child);
+        heap.write_barrier(owner.get(), child);
+    }
+    EXPECT_EQ(owner->traces, 1);
+    for (heap_ptr<Node> &child : children) {
+        EXPECT_TRUE(child.get()->is_marked());
+    }
+}
+
+TEST(HeapTests, TestStatsRecordCycles) {
+    Heap heap{};
+    auto kept = heap.make<Node>(nullptr);
+    heap.make<Node>(nullptr);
+    heap.make_sized<Bytes>(10, 10);
+    size_t node_size = sizeof(HeapObj<Node>);
+    size_t bytes_size = sizeof(HeapObj<Bytes>) + 10;
+    uint8_t node_type = gc::type_index(type_name<Node>());
+    uint8_t bytes_type = gc::type_index(type_name<Bytes>());
+    EXPECT_EQ(heap.live_by_type()[node_type].objects, 2);
+    EXPECT_EQ(heap.live_by_type()[bytes_type].bytes, bytes_size);
+
+    // Accounted to the next collection to finish.
+    heap.record_pause(std::chrono::milliseconds(1));
+    collect(heap, gc::Collection::MINOR, {kept});
+    heap.record_pause(std::chrono::milliseconds(1));
+    ASSERT_EQ(heap.recent_cycles().size(), 1);
+    const gc::CycleStats &minor = heap.recent_cycles().back();
+    EXPECT_EQ(minor.collection, gc::Collection::MINOR);
+    EXPECT_EQ(minor.pause, std::chrono::milliseconds(2));
+    EXPECT_EQ(minor.allocated, 2 * node_size + bytes_size);
+    EXPECT_EQ(minor.freed_objects, 2);
+    EXPECT_EQ(minor.freed_bytes, node_size + bytes_size);
+    EXPECT_EQ(minor.live_bytes, node_size);
+    EXPECT_EQ(minor.live[node_type].objects, 1);
+    EXPECT_EQ(minor.live[bytes_type].objects, 0);
+
+    heap.make<Node>(nullptr);
+    collect(heap, gc::Collection::MAJOR, {});
+    heap.record_pause(std::chrono::milliseconds(1));
+    const gc::CycleStats &major = heap.recent_cycles().back();
+    EXPECT_EQ(major.collection, gc::Collection::MAJOR);
+    EXPECT_EQ(major.allocated, node_size);
+    EXPECT_EQ(major.freed_objects, 2);
+    EXPECT_EQ(major.live_bytes, 0);
+
+    gc::HeapStats totals = heap.stats();
+    EXPECT_EQ(totals.minor_collections, 1);
+    EXPECT_EQ(totals.major_collections, 1);
+    EXPECT_EQ(totals.total_pause, std::chrono::milliseconds(3));
+    EXPECT_EQ(totals.max_pause, std::chrono::milliseconds(1));
+    EXPECT_EQ(totals.freed_objects, 4);
+    EXPECT_EQ(totals.allocated, 3 * node_size + bytes_size);
+}
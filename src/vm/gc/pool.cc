@@ -0,0 +1,81 @@
+#include "pool.h"
+
+#include <new>
+
+using namespace gc;
+
+constexpr size_t slot_size(uint8_t size_class) {
+    return (size_class + 1) * Pool::GRANULE;
+}
+
+Pool::Pool() : classes{}, large_count(0) {}
+
+Pool::~Pool() {
+    for (auto &size_class : classes) {
+        for (std::byte *block : size_class.blocks) {
+            ::operator delete(block);
+        }
+    }
+}
+
+void *Pool::allocate(uint8_t size_class, size_t size) {
+    if (size_class == LARGE) {
+        ++large_count;
+        return ::operator new(size);
+    }
+
+    SizeClass &cls = classes[size_class];
+    if (cls.free_list == nullptr) {
+        add_block(size_class);
+    }
+    FreeSlot *slot = cls.free_list;
+    cls.free_list = slot->next;
+    ++cls.slots_used;
+    return slot;
+}
+
+void Pool::deallocate(void *ptr, uint8_t size_class) {
+    if (size_class == LARGE) {
+        --large_count;
+        ::operator delete(ptr);
+        return;
+    }
+
+    SizeClass &cls = classes[size_class];
+    FreeSlot *slot = static_cast<FreeSlot *>(ptr);
+    slot->next = cls.free_list;
+    cls.free_list = slot;
+    --cls.slots_used;
+}
+
+std::vector<Pool::ClassStats> Pool::stats() const {
+    std::vector<ClassStats> result;
+    for (uint8_t size_class = 0; size_class < CLASS_COUNT; ++size_class) {
+        const SizeClass &cls = classes[size_class];
+        if (cls.blocks.empty()) {
+            continue;
+        }
+        size_t size = slot_size(size_class);
+        result.push_back({size, cls.blocks.size(), cls.slots_used,
+                          cls.blocks.size() * (BLOCK_SIZE / size)});
+    }
+    return result;
+}
+
+size_t Pool::large_allocations() const { return large_count; }
+
+void Pool::add_block(uint8_t size_class) {
+    SizeClass &cls = classes[size_class];
+    size_t size = slot_size(size_class);
+    std::byte *block = static_cast<std::byte *>(::operator new(BLOCK_SIZE));
+    cls.blocks.push_back(block);
+
+    // Thread the new slots onto the free list, lowest address first, so
+    // consecutive allocations are adjacent in memory.
+    for (size_t offset = (BLOCK_SIZE / size) * size; offset > 0;) {
+        offset -= size;
+        FreeSlot *slot = reinterpret_cast<FreeSlot *>(block + offset);
+        slot->next = cls.free_list;
+        cls.free_list = slot;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gc {
+
+/** A size-segregated slab allocator for heap objects.
+ * Small allocations are rounded up to a size class. Every class carves
+ * page-sized blocks into equal slots, and keeps freed slots on an intrusive
+ * free list for reuse. Allocations above the largest class go to `operator
+ * new`.
+ */
+struct Pool {
+    static constexpr size_t BLOCK_SIZE = 4096;
+    static constexpr size_t GRANULE = 16;
+    static constexpr size_t CLASS_COUNT = 16;
+    static constexpr size_t MAX_SMALL_SIZE = GRANULE * CLASS_COUNT;
+    // The size class of allocations that don't fit any class.
+    static constexpr uint8_t LARGE = CLASS_COUNT;
+
+    struct ClassStats {
+        size_t slot_size;
+        size_t blocks;
+        size_t slots_used;
+        size_t slots_total;
+    };
+
+    Pool();
+
+    static constexpr uint8_t size_class(size_t size) {
+        if (size > MAX_SMALL_SIZE) {
+            return LARGE;
+        }
+        return static_cast<uint8_t>((size + GRANULE - 1) / GRANULE - 1);
+    }
+
+    void *allocate(uint8_t size_class, size_t size);
+    void deallocate(void *ptr, uint8_t size_class);
+
+    /** Occupancy of every size class that has at least one block. */
+    std::vector<ClassStats> stats() const;
+    size_t large_allocations() const;
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    ~Pool();
+
+  private:
+    struct FreeSlot {
+        FreeSlot *next;
+    };
+
+    struct SizeClass {
+        FreeSlot *free_list = nullptr;
+        std::vector<std::byte *> blocks;
+        size_t slots_used = 0;
+    };
+
+    void add_block(uint8_t size_class);
+
+    std::array<SizeClass, CLASS_COUNT> classes;
+    size_t large_count;
+};
+
+}; // namespace gc
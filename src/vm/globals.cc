@@ -0,0 +1,61 @@
+#include "globals.h"
+
+#include "src/debug_flags.h"
+
+#include <limits>
+
+Globals::Globals()
+    : values(), names(), slots(), dirty(), dirty_slots() {}
+
+std::optional<global_ref_t> Globals::resolve(heap_ptr<ObjString> name) {
+    auto slot_it = slots.find(name);
+    if (slot_it != slots.end()) {
+        return slot_it->second;
+    }
+
+    if (values.size() > std::numeric_limits<global_ref_t>::max()) {
+        return std::nullopt;
+    }
+    global_ref_t slot = values.size();
+    values.push_back(Value::undefined());
+    names.push_back(name);
+    slots.emplace(name, slot);
+    dirty.push_back(false);
+    write_barrier(slot);
+    return slot;
+}
+
+heap_ptr<ObjString> Globals::name(global_ref_t slot) const {
+    return names[slot];
+}
+
+void Globals::mark(gc::GrayStack &gray) {
+    for (size_t slot = 0; slot < values.size(); ++slot) {
+        mark_slot(gray, slot);
+    }
+    clear_dirty();
+}
+
+void Globals::mark_dirty(gc::GrayStack &gray) {
+    for (global_ref_t slot : dirty_slots) {
+        mark_slot(gray, slot);
+    }
+    clear_dirty();
+}
+
+void Globals::mark_slot(gc::GrayStack &gray, global_ref_t slot) {
+    names[slot].mark(gray);
+    // name is not a `Value` so we need to log its mark.
+    if constexpr (DEBUG_LOG_GC) {
+        std::cout << names[slot].get() << " mark " << names[slot]->str()
+                  << "\n";
+    }
+    values[slot].mark(gray);
+}
+
+void Globals::clear_dirty() {
+    for (global_ref_t slot : dirty_slots) {
+        dirty[slot] = false;
+    }
+    dirty_slots.clear();
+}
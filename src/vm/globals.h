@@ -0,0 +1,52 @@
+#pragma once
+
+#include "src/vm/code.h"
+#include "src/vm/gc/heap_obj.h"
+#include "src/vm/value.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+/** The VM-wide global variables.
+ * The compiler resolves every global name to a dense slot, so the VM reads and
+ * writes `values` by index instead of hashing names at runtime.
+ */
+struct Globals {
+    Globals();
+
+    /** Get the slot of `name`, assigning it a new undefined slot if it has
+     * none yet. Returns nullopt if there are no slots left.
+     */
+    std::optional<global_ref_t> resolve(heap_ptr<ObjString> name);
+
+    heap_ptr<ObjString> name(global_ref_t slot) const;
+
+    /** Must be called after writing to `values[slot]`. */
+    void write_barrier(global_ref_t slot) {
+        if (!dirty[slot]) {
+            dirty[slot] = true;
+            dirty_slots.push_back(slot);
+        }
+    }
+
+    /** Mark every slot. */
+    void mark(gc::GrayStack &gray);
+    /** Mark only the slots written since the last time globals were marked.
+     * Enough for minor collections, and for the final pause of incremental
+     * marking.
+     */
+    void mark_dirty(gc::GrayStack &gray);
+
+    // Slots that were not defined yet hold `Value::undefined()`.
+    std::vector<Value> values;
+
+  private:
+    void mark_slot(gc::GrayStack &gray, global_ref_t slot);
+    void clear_dirty();
+
+    std::vector<heap_ptr<ObjString>> names;
+    StringKeyMap<global_ref_t> slots;
+    std::vector<uint8_t> dirty;
+    std::vector<global_ref_t> dirty_slots;
+};
@@ -1,20 +1,68 @@
 #include "heap_manager.h"
 
-HeapManager::HeapManager() : heap(), strings() {}
+#include <algorithm>
+#include <array>
+#include <iterator>
+
+HeapManager::HeapManager()
+    : heap(), strings(), young_strings(), roots() {}
 
 heap_ptr<ObjString> HeapManager::initialize(const std::string &string) {
-    auto string_it = strings.find(string);
+    return initialize(std::string_view(string));
+}
+
+heap_ptr<ObjString> HeapManager::initialize(const std::string_view &string) {
+    object::hash_t hash = object::str_hash_func(string);
+    if (auto interned = find_interned(StringKey{string, hash})) {
+        return *interned;
+    }
+    return add_interned(string, hash);
+}
+
+heap_ptr<ObjString> HeapManager::concatenate(heap_ptr<ObjString> string1,
+                                             heap_ptr<ObjString> string2) {
+    if (string1->length() + string2->length() >= MIN_ROPE_LENGTH) {
+        // Allocating the rope might collect its parts.
+        push_root(string1);
+        push_root(string2);
+        auto rope = heap.make<ObjString>(string1, string2);
+        rope->charge_to(heap, rope.get());
+        pop_root();
+        pop_root();
+        return rope;
+    }
+    // Short enough to build on the stack, and only copy into the new string.
+    std::array<char, MIN_ROPE_LENGTH> buffer;
+    std::string_view left = string1->str();
+    std::string_view right = string2->str();
+    char *end = std::copy(left.begin(), left.end(), buffer.data());
+    end = std::copy(right.begin(), right.end(), end);
+    std::string_view chars(buffer.data(), end - buffer.data());
+    object::hash_t hash = object::str_hash_func(chars);
+    if (auto interned = find_interned(StringKey{chars, hash})) {
+        return *interned;
+    }
+    return add_interned(chars, hash);
+}
+
+std::optional<heap_ptr<ObjString>>
+HeapManager::find_interned(const StringKey &key) {
+    auto string_it = strings.find(key);
     if (string_it == strings.end()) {
-        auto object = heap.make<ObjString>(string);
-        strings.emplace(string, object);
-        return object;
-    } else {
-        return string_it->second;
+        return std::nullopt;
     }
+    heap_ptr<ObjString> string = *string_it;
+    // The intern table is weak, so marking might not have reached it.
+    heap.shade(string.get());
+    return string;
 }
 
-heap_ptr<ObjString> HeapManager::initialize(const std::string_view &string) {
-    return initialize(std::string(string));
+heap_ptr<ObjString> HeapManager::add_interned(std::string_view chars,
+                                              object::hash_t hash) {
+    auto object = heap.make_sized<ObjString>(chars.size(), chars, hash);
+    strings.insert(object);
+    young_strings.push_back(object);
+    return object;
 }
 
 heap_ptr<ObjFunction> HeapManager::new_function() {
@@ -22,7 +70,14 @@ heap_ptr<ObjFunction> HeapManager::new_function() {
 }
 
 heap_ptr<ObjFunction> HeapManager::new_function(heap_ptr<ObjString> name) {
-    return heap.make<ObjFunction>(0, name);
+    if (name == nullptr) {
+        return heap.make<ObjFunction>(0, name);
+    }
+    // Allocating the function might collect the name.
+    push_root(name);
+    auto function = heap.make<ObjFunction>(0, name);
+    pop_root();
+    return function;
 }
 
 heap_ptr<ObjFunction> HeapManager::new_function(const std::string &name) {
@@ -32,3 +87,38 @@ heap_ptr<ObjFunction> HeapManager::new_function(const std::string &name) {
 heap_ptr<ObjFunction> HeapManager::new_function(const std::string_view &name) {
     return new_function(initialize(name));
 }
+
+void HeapManager::push_root(const Value &value) { roots.push_back(value); }
+
+void HeapManager::pop_root() { roots.pop_back(); }
+
+void HeapManager::mark_roots(gc::GrayStack &gray) {
+    for (auto &root : roots) {
+        root.mark(gray);
+    }
+}
+
+void HeapManager::collect(gc::GrayStack &gray) {
+    heap.mark_remembered(gray);
+    heap.trace_references(gray);
+    remove_white_strings(gray.collection);
+    heap.sweep(gray.collection);
+}
+
+Heap &HeapManager::get_heap() { return heap; }
+
+void HeapManager::remove_white_strings(gc::Collection collection) {
+    if (collection == gc::Collection::MINOR) {
+        // Only young strings can be freed, so don't scan the whole table.
+        for (auto &string : young_strings) {
+            if (!string.get()->is_marked()) {
+                strings.erase(string);
+            }
+        }
+    } else {
+        std::erase_if(strings, [](const heap_ptr<ObjString> &string) {
+            return !string.get()->is_marked();
+        });
+    }
+    young_strings.clear();
+}
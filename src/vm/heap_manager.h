@@ -4,10 +4,15 @@
 #include "src/vm/obj_function.h"
 #include "src/vm/value.h"
 
+#include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 struct HeapManager {
+    /** Concatenations at least this long are ropes rather than interned. */
+    static constexpr size_t MIN_ROPE_LENGTH = 128;
+
     HeapManager();
 
     template <typename T, typename... Args>
@@ -17,13 +22,46 @@ struct HeapManager {
 
     heap_ptr<ObjString> initialize(const std::string &string);
     heap_ptr<ObjString> initialize(const std::string_view &string);
+    /** The concatenation of `string1` and `string2`. Short results are
+     * interned, and their characters are only copied once, into the new
+     * string if it isn't interned yet. Long results are ropes, so that
+     * building a string in a loop doesn't copy it on every iteration.
+     */
+    heap_ptr<ObjString> concatenate(heap_ptr<ObjString> string1,
+                                    heap_ptr<ObjString> string2);
 
     heap_ptr<ObjFunction> new_function();
     heap_ptr<ObjFunction> new_function(heap_ptr<ObjString> name);
     heap_ptr<ObjFunction> new_function(const std::string &name);
     heap_ptr<ObjFunction> new_function(const std::string_view &name);
 
+    /** Keep `value` alive until the matching `pop_root`, for objects that are
+     * not reachable from the VM yet (e.g. functions being compiled).
+     */
+    void push_root(const Value &value);
+    void pop_root();
+
+    /** Mark the extra roots held by the heap manager. */
+    void mark_roots(gc::GrayStack &gray);
+    /** Trace from the marked roots, then free everything unreachable that
+     * the collection of `gray` is allowed to free.
+     */
+    void collect(gc::GrayStack &gray);
+
+    Heap &get_heap();
+
   private:
+    std::optional<heap_ptr<ObjString>> find_interned(const StringKey &key);
+    /** Intern a new string. `hash` must be the hash of `chars`. */
+    heap_ptr<ObjString> add_interned(std::string_view chars,
+                                     object::hash_t hash);
+
+    /** Interned strings don't keep themselves alive. */
+    void remove_white_strings(gc::Collection collection);
+
     Heap heap;
-    StringMap strings;
-};
\ No newline at end of file
+    StringSet strings;
+    // Strings interned since the last collection.
+    std::vector<heap_ptr<ObjString>> young_strings;
+    std::vector<Value> roots;
+};
@@ -1,9 +1,25 @@
 #include "obj_function.h"
 
+#include "src/vm/obj_upvalue.h"
+
 ObjFunction::ObjFunction(int arity, heap_ptr<ObjString> name)
     : arity(arity), name(name), upvalue_count(0), chunk() {}
 
+void ObjFunction::trace(gc::GrayStack &gray) {
+    name.mark(gray);
+    for (auto &constant : chunk.constants) {
+        constant.mark(gray);
+    }
+}
+
 ObjClosure::ObjClosure(heap_ptr<ObjFunction> function)
     : function(function), upvalue_count(function->upvalue_count) {
     upvalues.reserve(upvalue_count);
 }
+
+void ObjClosure::trace(gc::GrayStack &gray) {
+    function.mark(gray);
+    for (auto &upvalue : upvalues) {
+        upvalue.mark(gray);
+    }
+}
@@ -4,19 +4,28 @@
 
 #include "src/vm/chunk.h"
 #include "src/vm/obj_upvalue.fwd.h"
+#include "src/vm/register_code.h"
+
+#include <memory>
 
 struct ObjFunction {
     ObjFunction(int arity, heap_ptr<ObjString> name);
 
+    void trace(gc::GrayStack &gray);
+
     int arity;
     heap_ptr<ObjString> name;
     const_ref_t upvalue_count;
     Chunk chunk;
+    // Translated from `chunk` by the register tier on the first call.
+    std::unique_ptr<RegisterCode> register_code;
 };
 
 struct ObjClosure {
     ObjClosure(heap_ptr<ObjFunction> function);
 
+    void trace(gc::GrayStack &gray);
+
     heap_ptr<ObjFunction> function;
     std::vector<heap_ptr<ObjUpvalue>> upvalues;
     const_ref_t upvalue_count;
@@ -1,4 +1,11 @@
 #include "obj_upvalue.h"
 
-ObjUpvalue::ObjUpvalue(size_t location)
-    : index(location), closed(std::nullopt) {}
+ObjUpvalue::ObjUpvalue(Value *location) : location(location), closed() {}
+
+void ObjUpvalue::close() {
+    closed = *location;
+    location = &closed;
+}
+
+// An open upvalue points into the stack, which is a root anyway.
+void ObjUpvalue::trace(gc::GrayStack &gray) { closed.mark(gray); }
@@ -3,30 +3,23 @@
 #include "src/vm/obj_upvalue.fwd.h"
 #include "src/vm/value.h"
 
-#include <optional>
-
 struct ObjUpvalue {
-    ObjUpvalue(size_t location);
+    ObjUpvalue(Value *location);
+
+    // `location` may point into `closed`, so an upvalue can't be copied.
+    ObjUpvalue(const ObjUpvalue &) = delete;
+    ObjUpvalue &operator=(const ObjUpvalue &) = delete;
+
+    Value &get() { return *location; }
+    const Value &get() const { return *location; }
+
+    /** Move the captured variable off the stack and into the upvalue. */
+    void close();
 
-    template <typename Allocator>
-    Value &get(std::vector<Value, Allocator> &stack) {
-        if (closed) {
-            return closed.value();
-        } else {
-            return stack[index];
-        }
-    }
-    template <typename Allocator>
-    const Value &get(const std::vector<Value, Allocator> &stack) const {
-        if (closed) {
-            return closed.value();
-        } else {
-            return stack[index];
-        }
-    }
+    void trace(gc::GrayStack &gray);
 
-    // Index of local variable captured by the upvalue, relative to the frame
-    // start.
-    size_t index;
-    std::optional<Value> closed;
-};
\ No newline at end of file
+    // The stack slot of the local variable captured by the upvalue while it is
+    // open, and `&closed` once it is closed.
+    Value *location;
+    Value closed;
+};
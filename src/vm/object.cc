@@ -1,19 +1,82 @@
 #include "object.h"
 
+#include "src/vm/gc/heap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 using namespace object;
 
-ObjString::ObjString(std::string s)
-    : string(std::move(s)), m_hash(str_hash_func(string)) {}
+ObjString::ObjString(std::string_view chars, hash_t hash)
+    : m_hash(hash), m_length(chars.size()), data(this->chars), left(nullptr),
+      right(nullptr) {
+    std::memcpy(this->chars, chars.data(), chars.size());
+}
+
+ObjString::ObjString(heap_ptr<ObjString> left, heap_ptr<ObjString> right)
+    : heap(nullptr), m_length(left->length() + right->length()),
+      object(nullptr), left(left), right(right) {}
 
-ObjString::operator std::string() const { return string; }
+ObjString::~ObjString() {
+    if (left == nullptr and !is_interned()) {
+        delete[] data;
+    }
+}
 
-const std::string &ObjString::str() const { return string; }
+ObjString::operator std::string() const { return std::string(str()); }
 
 bool ObjString::operator==(const ObjString &other) const {
-    return string == other.string;
+    if (this == &other) {
+        return true;
+    }
+    if (is_interned() and other.is_interned()) {
+        return false;
+    }
+    return m_length == other.m_length and hash() == other.hash() and
+           str() == other.str();
+}
+
+// The characters of a flat string are allocated with it, and those of a rope
+// once it is flattened.
+size_t ObjString::heap_size() const {
+    return left == nullptr ? m_length : 0;
+}
+
+void ObjString::trace(gc::GrayStack &gray) {
+    left.mark(gray);
+    right.mark(gray);
 }
 
-hash_t ObjString::hash() const { return m_hash; }
+void ObjString::charge_to(Heap &heap, HeapData *object) {
+    this->heap = &heap;
+    this->object = object;
+}
+
+void ObjString::flatten() const {
+    Heap &owner_heap = *heap;
+    HeapData *owner = object;
+    char *buffer = new char[m_length];
+    char *end = buffer;
+    // Ropes built in a loop are as deep as they are long, so no recursion.
+    std::vector<const ObjString *> pending{this};
+    while (!pending.empty()) {
+        const ObjString *part = pending.back();
+        pending.pop_back();
+        if (part->left == nullptr) {
+            end = std::copy_n(part->data, part->m_length, end);
+        } else {
+            pending.push_back(&*part->right);
+            pending.push_back(&*part->left);
+        }
+    }
+    data = buffer;
+    m_hash = str_hash_func(std::string_view(data, m_length));
+    // The parts may be freed now.
+    left = nullptr;
+    right = nullptr;
+    owner_heap.grow(owner, m_length);
+}
 
 hash_t ObjStringHash::operator()(const ObjString &string) {
     return string.hash();
@@ -4,31 +4,100 @@
 #include <functional>
 #include <span>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <utility>
 
+struct Heap;
 struct Value;
 
 namespace object {
-constinit inline auto str_hash_func = std::hash<std::string>{};
-using hash_t = std::invoke_result_t<decltype(str_hash_func), std::string>;
+constinit inline auto str_hash_func = std::hash<std::string_view>{};
+using hash_t = std::invoke_result_t<decltype(str_hash_func), std::string_view>;
 }; // namespace object
 
+/** A Lox string. Strings are either flat and interned, or ropes: the lazy
+ * concatenation of two strings, which is only flattened once its characters
+ * are needed. Ropes are not interned, so only two interned strings can be
+ * compared by address.
+ *
+ * A flat string stores its characters inline, right after the object, so it
+ * is a single allocation. A flattened rope stores them in a separate buffer,
+ * which the heap is only charged for once it is allocated.
+ */
 struct ObjString {
-    ObjString(std::string s);
+    /** A flat string. Must be allocated with `chars.size()` bytes after it,
+     * by `Heap::make_sized`. `hash` must be the hash of `chars`.
+     */
+    ObjString(std::string_view chars, object::hash_t hash);
+    /** A rope of `left` followed by `right`. `charge_to` must be called
+     * before it is flattened.
+     */
+    ObjString(heap_ptr<ObjString> left, heap_ptr<ObjString> right);
+    ~ObjString();
+
+    ObjString(const ObjString &) = delete;
+    ObjString &operator=(const ObjString &) = delete;
 
     operator std::string() const;
-    const std::string &str() const;
+    /** The characters of the string, flattening it if it is a rope. */
+    std::string_view str() const;
+    size_t length() const;
+    bool is_interned() const;
 
     bool operator==(const ObjString &other) const;
 
     object::hash_t hash() const;
 
+    size_t heap_size() const;
+    void trace(gc::GrayStack &gray);
+    /** Charge the buffer of this rope to `object`, the rope's object on
+     * `heap`, when it is flattened.
+     */
+    void charge_to(Heap &heap, HeapData *object);
+
   private:
-    std::string string;
-    object::hash_t m_hash;
+    void flatten() const;
+
+    union {
+        mutable object::hash_t m_hash;
+        // The heap of a rope that was not flattened yet.
+        Heap *heap;
+    };
+    size_t m_length;
+    union {
+        // Points to `chars`, or to the buffer of a flattened rope.
+        mutable const char *data;
+        // The object of a rope that was not flattened yet.
+        HeapData *object;
+    };
+    // The parts of a rope that was not flattened yet, null otherwise.
+    mutable heap_ptr<ObjString> left;
+    mutable heap_ptr<ObjString> right;
+    // The characters of a flat string. Empty in a rope.
+    char chars[];
 };
 
+inline std::string_view ObjString::str() const {
+    if (left != nullptr) {
+        flatten();
+    }
+    return std::string_view(data, m_length);
+}
+
+inline size_t ObjString::length() const { return m_length; }
+
+inline bool ObjString::is_interned() const {
+    return left == nullptr and data == chars;
+}
+
+inline object::hash_t ObjString::hash() const {
+    if (left != nullptr) {
+        flatten();
+    }
+    return m_hash;
+}
+
 struct ObjStringHash {
     object::hash_t operator()(const ObjString &string);
 };
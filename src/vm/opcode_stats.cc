@@ -0,0 +1,114 @@
+#include "opcode_stats.h"
+
+#include "src/vm/code.h"
+#include "src/vm/register_code.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <numeric>
+#include <tuple>
+
+OpcodeStats::OpcodeStats(std::span<const char *const> names)
+    : names(names), opcodes(names.size()),
+      pairs(names.size() * names.size()), current_frame(nullptr),
+      current_function(nullptr), function_instructions(nullptr),
+      previous(NO_OPCODE) {}
+
+void OpcodeStats::enter(const CallFrame *frame) {
+    current_frame = frame;
+    current_function = frame->closure->function.get();
+    previous = NO_OPCODE;
+    auto [it, inserted] =
+        function_counters.try_emplace(current_function, nullptr);
+    if (inserted) {
+        const ObjFunction &function = *frame->closure->function;
+        const auto &lines = function.chunk.line_data().lines;
+        std::string_view name = function.name.get() == nullptr
+                                    ? "script"
+                                    : function.name->str();
+        int line = lines.empty() ? 0 : lines.front().first;
+        it->second = &functions[fmt::format("{}:{}", name, line)];
+    }
+    function_instructions = it->second;
+}
+
+void OpcodeStats::forget_functions() {
+    function_counters.clear();
+    current_frame = nullptr;
+    current_function = nullptr;
+}
+
+std::string OpcodeStats::to_json() const {
+    std::vector<std::tuple<uint64_t, size_t>> sorted_opcodes;
+    for (size_t i = 0; i < opcodes.size(); ++i) {
+        if (opcodes[i] > 0) {
+            sorted_opcodes.emplace_back(opcodes[i], i);
+        }
+    }
+    std::vector<std::tuple<uint64_t, size_t>> sorted_pairs;
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        if (pairs[i] > 0) {
+            sorted_pairs.emplace_back(pairs[i], i);
+        }
+    }
+    std::vector<std::tuple<uint64_t, std::string_view>> sorted_functions;
+    for (const auto &[name, count] : functions) {
+        sorted_functions.emplace_back(count, name);
+    }
+    // By decreasing count, then by name or opcode.
+    auto by_count = [](const auto &a, const auto &b) {
+        return std::get<0>(a) != std::get<0>(b)
+                   ? std::get<0>(a) > std::get<0>(b)
+                   : std::get<1>(a) < std::get<1>(b);
+    };
+    std::ranges::sort(sorted_opcodes, by_count);
+    std::ranges::sort(sorted_pairs, by_count);
+    std::ranges::sort(sorted_functions, by_count);
+
+    uint64_t total = std::accumulate(opcodes.begin(), opcodes.end(),
+                                     uint64_t{0});
+    std::string json = fmt::format("{{\n  \"instructions\": {},\n", total);
+    json += "  \"opcodes\": [";
+    const char *separator = "\n";
+    for (const auto &[count, opcode] : sorted_opcodes) {
+        json += fmt::format("{}    {{\"opcode\": \"{}\", \"count\": {}}}",
+                            separator, names[opcode], count);
+        separator = ",\n";
+    }
+    json += "\n  ],\n  \"pairs\": [";
+    separator = "\n";
+    for (const auto &[count, pair] : sorted_pairs) {
+        json += fmt::format(
+            "{}    {{\"first\": \"{}\", \"second\": \"{}\", \"count\": {}}}",
+            separator, names[pair / names.size()], names[pair % names.size()],
+            count);
+        separator = ",\n";
+    }
+    json += "\n  ],\n  \"functions\": [";
+    separator = "\n";
+    for (const auto &[count, name] : sorted_functions) {
+        json += fmt::format("{}    {{\"function\": \"{}\", \"count\": {}}}",
+                            separator, name, count);
+        separator = ",\n";
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+std::span<const char *const> opcode_names() {
+    static const char *const names[] = {
+#define OPCODE_NAME(op) #op,
+        LOX_OPCODES(OPCODE_NAME)
+#undef OPCODE_NAME
+    };
+    return names;
+}
+
+std::span<const char *const> register_opcode_names() {
+    static const char *const names[] = {
+#define REG_OPCODE_NAME(op) #op,
+        LOX_REG_OPCODES(REG_OPCODE_NAME)
+#undef REG_OPCODE_NAME
+    };
+    return names;
+}
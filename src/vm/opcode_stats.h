@@ -0,0 +1,73 @@
+#pragma once
+
+#include "src/vm/call_frame.h"
+#include "src/vm/obj_function.h"
+
+#include <cstdint>
+#include <map>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** Execution counts of the opcodes of one tier, gathered by the VM when
+ * `DEBUG_COUNT_OPCODES` is set: how often each opcode ran, how often each
+ * opcode ran right after another in the same frame, and how many
+ * instructions each function ran.
+ *
+ * Pairs are what a superinstruction would fuse, so the pairs across calls
+ * and returns aren't counted.
+ */
+struct OpcodeStats {
+    /** Stats of opcodes named `names`, indexed by opcode. */
+    OpcodeStats(std::span<const char *const> names);
+
+    /** Count executing `opcode` in `frame`. */
+    void count(uint8_t opcode, const CallFrame *frame) {
+        if (frame != current_frame or
+            frame->closure->function.get() != current_function) {
+            enter(frame);
+        }
+        ++opcodes[opcode];
+        if (previous != NO_OPCODE) {
+            ++pairs[previous * names.size() + opcode];
+        }
+        previous = opcode;
+        ++*function_instructions;
+    }
+
+    /** Forget which function each address holds, after the GC might have
+     * freed some.
+     */
+    void forget_functions();
+
+    /** The stats as a JSON object, with every list sorted by decreasing
+     * count.
+     */
+    std::string to_json() const;
+
+  private:
+    static constexpr size_t NO_OPCODE = SIZE_MAX;
+
+    void enter(const CallFrame *frame);
+
+    std::span<const char *const> names;
+    std::vector<uint64_t> opcodes;
+    // Indexed by the first opcode times the number of opcodes, plus the
+    // second.
+    std::vector<uint64_t> pairs;
+    // Instructions by function, keyed by its name and the line of its first
+    // instruction, since functions don't outlive the GC.
+    std::map<std::string, uint64_t> functions;
+    std::unordered_map<const HeapObj<ObjFunction> *, uint64_t *>
+        function_counters;
+
+    const CallFrame *current_frame;
+    const HeapObj<ObjFunction> *current_function;
+    uint64_t *function_instructions;
+    size_t previous;
+};
+
+/** Names of the stack tier's and the register tier's opcodes. */
+std::span<const char *const> opcode_names();
+std::span<const char *const> register_opcode_names();
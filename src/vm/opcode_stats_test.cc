@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include "src/vm/heap_manager.h"
+#include "src/vm/opcode_stats.h"
+
+#include <string>
+
+class OpcodeStatsTests : public testing::Test {
+  protected:
+    /** A frame running a function called `name`, defined at `line`. */
+    CallFrame make_frame(heap_ptr<ObjString> name, int line) {
+        auto function = heap_manager.initialize<ObjFunction>(0, name);
+        function->chunk.write(OpCode::RETURN, line);
+        auto closure = heap_manager.initialize<ObjClosure>(function);
+        return CallFrame(closure, function->chunk.code.cbegin(), nullptr);
+    }
+
+    void count(OpCode opcode, const CallFrame &frame) {
+        stats.count(static_cast<uint8_t>(opcode), &frame);
+    }
+
+    HeapManager heap_manager;
+    OpcodeStats stats{opcode_names()};
+};
+
+TEST_F(OpcodeStatsTests, TestCountsPairsWithinFrames) {
+    CallFrame script = make_frame(nullptr, 1);
+    CallFrame f = make_frame(heap_manager.initialize(std::string("f")), 3);
+    count(OpCode::GET_LOCAL, script);
+    count(OpCode::ADD, script);
+    count(OpCode::CALL, script);
+    count(OpCode::GET_LOCAL, f);
+    count(OpCode::RETURN, f);
+    count(OpCode::GET_LOCAL, script);
+    count(OpCode::ADD, script);
+
+    std::string json = stats.to_json();
+    EXPECT_NE(json.find("\"instructions\": 7"), std::string::npos) << json;
+    EXPECT_NE(json.find(R"({"opcode": "GET_LOCAL", "count": 3})"),
+              std::string::npos)
+        << json;
+    EXPECT_NE(
+        json.find(R"({"first": "GET_LOCAL", "second": "ADD", "count": 2})"),
+        std::string::npos)
+        << json;
+    // Calls and returns don't make pairs.
+    EXPECT_EQ(json.find(R"("first": "CALL")"), std::string::npos) << json;
+    EXPECT_EQ(json.find(R"("first": "RETURN")"), std::string::npos) << json;
+    EXPECT_NE(json.find(R"({"function": "script:1", "count": 5})"),
+              std::string::npos)
+        << json;
+    EXPECT_NE(json.find(R"({"function": "f:3", "count": 2})"),
+              std::string::npos)
+        << json;
+}
@@ -0,0 +1,238 @@
+#include "profiler.h"
+
+#include "src/vm/obj_function.h"
+#include "src/vm/object.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string_view>
+
+std::atomic<Profiler *> Profiler::active = nullptr;
+
+namespace {
+
+/** The source line `frame` is at, or 0 if it can't be told. Unlike
+ * `CallFrame::current_line`, it doesn't write the chunk's line cache, and
+ * checks that the frame's ip is in its function's code, since the signal
+ * handler might catch a tail call replacing the frame.
+ */
+int sample_line(const CallFrame &frame) {
+    const ObjFunction &function = *frame.closure->function;
+    if (frame.reg_ip != nullptr) {
+        const RegisterCode *code = function.register_code.get();
+        if (code == nullptr) {
+            return 0;
+        }
+        // A frame that didn't call anything yet is at its first instruction.
+        ptrdiff_t index =
+            std::max<ptrdiff_t>(frame.reg_ip - code->code.data() - 1, 0);
+        if (index >= static_cast<ptrdiff_t>(code->lines.size())) {
+            return 0;
+        }
+        return code->lines[index];
+    }
+
+    const Chunk &chunk = function.chunk;
+    ptrdiff_t offset = std::to_address(frame.ip) - chunk.code.data() - 1;
+    if (offset < 0 or offset >= static_cast<ptrdiff_t>(chunk.code.size())) {
+        return 0;
+    }
+    for (const auto &[line, count] : chunk.line_data().lines) {
+        if (offset < count) {
+            return line;
+        }
+        offset -= count;
+    }
+    return 0;
+}
+
+void copy_name(const CallFrame &frame, char (&name)[Profiler::MAX_NAME]) {
+    heap_ptr<ObjString> function_name = frame.closure->function->name;
+    std::string_view chars = "script";
+    // Names are interned, so reading them doesn't flatten a rope.
+    if (function_name != nullptr) {
+        chars = function_name->is_interned() ? function_name->str() : "?";
+    }
+    size_t size = std::min(chars.size(), Profiler::MAX_NAME - 1);
+    std::memcpy(name, chars.data(), size);
+    name[size] = '\0';
+}
+
+} // namespace
+
+Profiler::Profiler(const FrameStack &frames, std::string path, int frequency)
+    : frames(frames), path(std::move(path)), frequency(frequency),
+      ring(std::make_unique<Sample[]>(CAPACITY)), head(0), tail(0),
+      m_dropped(0), running(false), timer(), stop_requested(false) {}
+
+std::unique_ptr<Profiler> Profiler::from_environment(const FrameStack &frames) {
+    const char *path = std::getenv("LOX_PROFILE");
+    if (path == nullptr or *path == '\0') {
+        return nullptr;
+    }
+    int frequency = DEFAULT_FREQUENCY;
+    if (const char *hz = std::getenv("LOX_PROFILE_HZ")) {
+        frequency = std::max(std::atoi(hz), 1);
+    }
+    auto profiler = std::make_unique<Profiler>(frames, path, frequency);
+    if (!profiler->start()) {
+        return nullptr;
+    }
+    return profiler;
+}
+
+bool Profiler::start() {
+    Profiler *expected = nullptr;
+    if (!active.compare_exchange_strong(expected, this)) {
+        std::cerr << "Another profiler is already running." << std::endl;
+        return false;
+    }
+
+    // The handler stays installed once the profiler stops, since a sample
+    // might still be pending, and it ignores samples without a profiler.
+    struct sigaction action = {};
+    action.sa_handler = handle_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    // The timer only counts the CPU time of this thread, and only interrupts
+    // it, so the stack is never read while it changes in another thread.
+    struct sigevent event = {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event._sigev_un._tid = static_cast<pid_t>(syscall(SYS_gettid));
+    if (sigaction(SIGPROF, &action, nullptr) != 0 or
+        timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) {
+        std::cerr << "Could not start the profiler: " << std::strerror(errno)
+                  << std::endl;
+        active.store(nullptr);
+        return false;
+    }
+
+    // Signals would interrupt the drainer's sleep, and are meant for the VM.
+    sigset_t profiling;
+    sigemptyset(&profiling);
+    sigaddset(&profiling, SIGPROF);
+    sigset_t previous;
+    pthread_sigmask(SIG_BLOCK, &profiling, &previous);
+    stop_requested = false;
+    drainer = std::thread([this]() { drain_periodically(); });
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+    long interval = 1'000'000'000 / frequency;
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = interval / 1'000'000'000;
+    spec.it_interval.tv_nsec = interval % 1'000'000'000;
+    spec.it_value = spec.it_interval;
+    timer_settime(timer, 0, &spec, nullptr);
+    running = true;
+    return true;
+}
+
+bool Profiler::stop() {
+    if (!running) {
+        return true;
+    }
+    running = false;
+    timer_delete(timer);
+    active.store(nullptr);
+    {
+        std::lock_guard lock(mutex);
+        stop_requested = true;
+    }
+    stopping.notify_one();
+    drainer.join();
+    drain();
+    return write();
+}
+
+uint64_t Profiler::dropped() const { return m_dropped.load(); }
+
+Profiler::~Profiler() { stop(); }
+
+void Profiler::handle_signal(int) {
+    int saved_errno = errno;
+    if (Profiler *profiler = active.load(std::memory_order_acquire)) {
+        profiler->record();
+    }
+    errno = saved_errno;
+}
+
+void Profiler::record() {
+    uint64_t index = head.load(std::memory_order_relaxed);
+    if (index - tail.load(std::memory_order_acquire) == CAPACITY) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Sample &sample = ring[index % CAPACITY];
+    sample.depth = 0;
+    sample.truncated = false;
+    bool complete = frames.visit([&sample](const CallFrame &frame) {
+        if (sample.depth == MAX_DEPTH) {
+            sample.truncated = true;
+            return false;
+        }
+        SampleFrame &recorded = sample.frames[sample.depth++];
+        copy_name(frame, recorded.name);
+        recorded.line = sample_line(frame);
+        return true;
+    });
+    if (!complete) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (sample.depth == 0) {
+        return;
+    }
+    head.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::drain() {
+    uint64_t end = head.load(std::memory_order_acquire);
+    std::string stack;
+    for (uint64_t index = tail.load(std::memory_order_relaxed); index < end;
+         ++index) {
+        const Sample &sample = ring[index % CAPACITY];
+        stack = sample.truncated ? "(truncated)" : "";
+        for (size_t i = sample.depth; i-- > 0;) {
+            if (!stack.empty()) {
+                stack += ';';
+            }
+            stack += sample.frames[i].name;
+            stack += ':';
+            stack += std::to_string(sample.frames[i].line);
+        }
+        ++stacks[stack];
+        tail.store(index + 1, std::memory_order_release);
+    }
+}
+
+void Profiler::drain_periodically() {
+    std::unique_lock lock(mutex);
+    while (!stopping.wait_for(lock, std::chrono::milliseconds(10),
+                              [this]() { return stop_requested; })) {
+        drain();
+    }
+}
+
+bool Profiler::write() const {
+    std::ofstream out(path);
+    for (const auto &[stack, count] : stacks) {
+        out << stack << ' ' << count << '\n';
+    }
+    out.close();
+    if (!out) {
+        std::cerr << "Could not write the profile to '" << path << "'."
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "src/vm/call_frame.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/** A statistical profiler of Lox code.
+ *
+ * While it runs, a timer interrupts the thread running the VM every so often
+ * of its CPU time, and the SIGPROF handler copies the Lox call stack (names
+ * and lines) into a lock-free ring buffer. A background thread folds the
+ * samples, and `stop` writes them as folded stacks, e.g.
+ * `script:12;fib:3;fib:3 42`, which flamegraph.pl and speedscope read.
+ *
+ * Samples taken while no Lox code runs (e.g. while compiling) are dropped.
+ * Only one profiler can run at a time.
+ */
+struct Profiler {
+    static constexpr int DEFAULT_FREQUENCY = 100;
+    // Frames recorded from the top of the stack. Deeper stacks are folded
+    // under a "(truncated)" root.
+    static constexpr size_t MAX_DEPTH = 128;
+    // Bytes of a function name recorded, including the terminator.
+    static constexpr size_t MAX_NAME = 32;
+    static constexpr size_t CAPACITY = 256;
+
+    /** A profiler of the VM using `frames`, writing to `path` once stopped.
+     * `frequency` is in samples per second of CPU time.
+     */
+    Profiler(const FrameStack &frames, std::string path,
+             int frequency = DEFAULT_FREQUENCY);
+    /** A running profiler writing to `$LOX_PROFILE`, sampling at
+     * `$LOX_PROFILE_HZ` if it is set. Null if `LOX_PROFILE` isn't set, or the
+     * profiler fails to start.
+     */
+    static std::unique_ptr<Profiler> from_environment(const FrameStack &frames);
+
+    /** Start sampling the calling thread. Returns false, after reporting the
+     * error, if it can't.
+     */
+    bool start();
+    /** Stop sampling, and write the profile. Returns false, after reporting
+     * the error, if it can't be written.
+     */
+    bool stop();
+
+    /** Samples lost because the ring buffer was full, or the stack was caught
+     * changing.
+     */
+    uint64_t dropped() const;
+
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+
+    /** Stops the profiler if it is running. */
+    ~Profiler();
+
+  private:
+    struct SampleFrame {
+        char name[MAX_NAME];
+        int line;
+    };
+    struct Sample {
+        // Frames from the top of the stack down.
+        std::array<SampleFrame, MAX_DEPTH> frames;
+        size_t depth;
+        bool truncated;
+    };
+
+    static void handle_signal(int signal);
+    /** Record a sample. Runs in the signal handler. */
+    void record();
+    /** Fold the samples in the ring buffer into `stacks`. */
+    void drain();
+    void drain_periodically();
+    bool write() const;
+
+    const FrameStack &frames;
+    std::string path;
+    int frequency;
+
+    std::unique_ptr<Sample[]> ring;
+    // Samples are written at `head` by the signal handler, and read at `tail`
+    // by the draining thread.
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint64_t> m_dropped;
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+    bool running;
+    timer_t timer;
+    std::thread drainer;
+    std::mutex mutex;
+    std::condition_variable stopping;
+    bool stop_requested;
+    // Number of samples of every folded stack.
+    std::map<std::string, uint64_t> stacks;
+
+    static std::atomic<Profiler *> active;
+};
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include "src/vm/profiler.h"
+#include "src/vm/vm.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+class ProfilerTests : public testing::TestWithParam<ExecutionTier> {
+  protected:
+    void SetUp() override {
+        path = fs::temp_directory_path() /
+               ("profile" + std::to_string(static_cast<int>(GetParam())));
+        fs::remove(path);
+    }
+
+    void TearDown() override { fs::remove(path); }
+
+    std::string read_profile() {
+        std::ifstream in(path);
+        std::stringstream contents;
+        contents << in.rdbuf();
+        return contents.str();
+    }
+
+    fs::path path;
+};
+
+TEST_P(ProfilerTests, TestSamplesFunctions) {
+    VM vm{InterpretMode::FILE, GetParam()};
+    Profiler profiler{vm.get_frames(), path, 10000};
+    ASSERT_TRUE(profiler.start());
+    EXPECT_EQ(interpret(vm, R"(
+        fun fib(n) {
+            if (n < 2) return n;
+            return fib(n - 1) + fib(n - 2);
+        }
+        fib(25);
+    )"),
+              InterpretResult::OK);
+    ASSERT_TRUE(profiler.stop());
+
+    std::string profile = read_profile();
+    EXPECT_NE(profile.find("script:6;fib:"), std::string::npos) << profile;
+}
+
+TEST_P(ProfilerTests, TestOnlyOneRuns) {
+    VM vm{InterpretMode::FILE, GetParam()};
+    Profiler first{vm.get_frames(), path};
+    Profiler second{vm.get_frames(), path};
+    ASSERT_TRUE(first.start());
+    EXPECT_FALSE(second.start());
+    EXPECT_TRUE(first.stop());
+    EXPECT_TRUE(second.start());
+}
+
+INSTANTIATE_TEST_SUITE_P(VMTests, ProfilerTests,
+                         testing::Values(ExecutionTier::STACK,
+                                         ExecutionTier::REGISTER));
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/** X-macro listing every register tier opcode, in encoding order.
+ *
+ * Operands named `a` are a destination register, a global slot, an upvalue
+ * index or a jump offset. Operands `b` and `c` are "RK" operands: either a
+ * register or, with `K_BIT` set, an index into the chunk's constants. `A` and
+ * `B` are `a` and `b` extended by the instruction's `ext` byte.
+ */
+#define LOX_REG_OPCODES(X)                                                     \
+    X(MOVE)          /* R[a] = RK[b] */                                        \
+    X(NIL)           /* R[a] = nil */                                          \
+    X(TRUE)          /* R[a] = true */                                         \
+    X(FALSE)         /* R[a] = false */                                        \
+    X(EQUAL)         /* R[a] = RK[b] == RK[c] */                               \
+    X(NOT_EQUAL)     /* R[a] = RK[b] != RK[c] */                               \
+    X(GREATER)       /* R[a] = RK[b] > RK[c] */                                \
+    X(LESS)          /* R[a] = RK[b] < RK[c] */                                \
+    X(GREATER_EQUAL) /* R[a] = RK[b] >= RK[c] */                               \
+    X(LESS_EQUAL)    /* R[a] = RK[b] <= RK[c] */                               \
+    X(ADD)           /* R[a] = RK[b] + RK[c] */                                \
+    X(SUBTRACT)      /* R[a] = RK[b] - RK[c] */                                \
+    X(MULTIPLY)      /* R[a] = RK[b] * RK[c] */                                \
+    X(DIVIDE)        /* R[a] = RK[b] / RK[c] */                                \
+    X(NOT)           /* R[a] = !RK[b] */                                       \
+    X(NEGATE)        /* R[a] = -RK[b] */                                       \
+    X(DEFINE_GLOBAL) /* Globals[a] = RK[b] */                                  \
+    X(SET_GLOBAL)    /* Globals[a] = RK[b], if defined */                      \
+    X(GET_GLOBAL)    /* R[a] = Globals[b] */                                   \
+    X(SET_UPVALUE)   /* Upvalues[a] = RK[b] */                                 \
+    X(GET_UPVALUE)   /* R[a] = Upvalues[b] */                                  \
+    X(PRINT)         /* print RK[b] */                                         \
+    X(JUMP)          /* ip += A */                                             \
+    X(LOOP)          /* ip -= A */                                             \
+    X(JUMP_IF_FALSE) /* if !RK[b]: ip += A */                                  \
+    X(JUMP_IF_TRUE)  /* if RK[b]: ip += A */                                   \
+    /* if !(RK[b] < RK[c]): ip += A */                                         \
+    X(JUMP_IF_NOT_LESS)                                                        \
+    /* if !(RK[b] > RK[c]): ip += A */                                         \
+    X(JUMP_IF_NOT_GREATER)                                                     \
+    X(CALL)          /* R[a] = R[a](R[a + 1], ..., R[a + b]) */                \
+    /* CALL replacing the caller's frame, followed by RETURN R[a] */           \
+    X(TAIL_CALL)                                                               \
+    /* R[a] = closure of function K[B], followed by one CAPTURE per upvalue */ \
+    X(CLOSURE)                                                                 \
+    /* CLOSURE operand, not executed: capture R[b] if a, else upvalue b */     \
+    X(CAPTURE)                                                                 \
+    X(CLOSE_UPVALUE) /* close upvalues from R[a] upwards */                    \
+    X(RETURN)        /* return RK[b] */                                        \
+    /* R[a] = K[B], for constants that don't fit in an RK operand */           \
+    X(LOAD_CONSTANT)
+
+enum struct RegOpCode : uint8_t {
+#define REG_OPCODE_ENUM(op) op,
+    LOX_REG_OPCODES(REG_OPCODE_ENUM)
+#undef REG_OPCODE_ENUM
+};
+
+constexpr int REG_OPCODE_COUNT = 0
+#define REG_OPCODE_ONE(op) +1
+    LOX_REG_OPCODES(REG_OPCODE_ONE)
+#undef REG_OPCODE_ONE
+    ;
+
+using reg_operand_t = uint16_t;
+
+/** Set on an RK operand that refers to a constant rather than a register. */
+constexpr reg_operand_t K_BIT = 0x8000;
+
+/** A fixed width register tier instruction. */
+struct RegInstruction {
+    RegOpCode opcode;
+    // High bits of the jump offset or constant index in `a` or `b`, which
+    // don't always fit in 16 bits.
+    uint8_t ext;
+    reg_operand_t a;
+    reg_operand_t b;
+    reg_operand_t c;
+
+    uint32_t wide_a() const { return a | ext << 16; }
+    uint32_t wide_b() const { return b | ext << 16; }
+};
+
+static_assert(sizeof(RegInstruction) == 8);
+
+/** The largest jump offset or constant index an instruction can hold. */
+constexpr uint32_t REG_WIDE_MAX = (1 << 24) - 1;
+
+/** Register tier code of a single function. Registers are the function's
+ * frame window into the VM stack, so register `i` is stack slot `i` of the
+ * stack tier: register 0 holds the callee and parameters follow it.
+ */
+struct RegisterCode {
+    std::vector<RegInstruction> code;
+    // Source line of every instruction.
+    std::vector<int> lines;
+    // Number of registers the function uses.
+    int frame_size = 0;
+};
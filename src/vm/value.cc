@@ -4,78 +4,20 @@
 #include "src/vm/obj_upvalue.h"
 #include <fmt/format.h>
 
-Value::Value() : m_type(ValueType::NIL) {}
-
-Value::Value(bool bool_val) : m_type(ValueType::BOOL), as(bool_val) {}
-
-Value::Value(double number) : m_type(ValueType::NUMBER), as(number) {}
-
-Value::Value(heap_ptr<ObjString> string)
-    : m_type(ValueType::STRING), as(string) {}
-
-Value::Value(heap_ptr<ObjFunction> function)
-    : m_type(ValueType::FUNCTION), as(function) {}
-
-Value::Value(heap_ptr<ObjNative> native)
-    : m_type(ValueType::NATIVE), as(native) {}
-
-Value::Value(heap_ptr<ObjClosure> closure)
-    : m_type(ValueType::CLOSURE), as(closure) {}
-
-Value::Value(heap_ptr<ObjUpvalue> upvalue)
-    : m_type(ValueType::UPVALUE), as(upvalue) {}
-
-Value::Value(const Value &other) : m_type(other.m_type) {
-    memcpy(&as, &other.as, sizeof(as));
-}
-
-ValueType Value::type() const { return m_type; }
-
-bool Value::as_bool() const { return as.boolean; }
-
-double Value::as_number() const { return as.number; }
-
-heap_ptr<ObjString> Value::as_string() const { return as.string; }
-
-heap_ptr<ObjFunction> Value::as_function() const { return as.function; }
-
-heap_ptr<ObjNative> Value::as_native() const { return as.native; }
-
-heap_ptr<ObjClosure> Value::as_closure() const { return as.closure; }
-
-heap_ptr<ObjUpvalue> Value::as_upvalue() const { return as.upvalue; }
-
-Value::operator double() const { return as_number(); }
-
-Value::operator heap_ptr<ObjString>() const { return as_string(); }
-
-Value::operator heap_ptr<ObjFunction>() const { return as_function(); }
-
-Value::operator heap_ptr<ObjNative>() const { return as_native(); }
-
-Value::operator heap_ptr<ObjClosure>() const { return as_closure(); }
-
-Value::operator heap_ptr<ObjUpvalue>() const { return as_upvalue(); }
-
-bool Value::is_bool() const { return m_type == ValueType::BOOL; }
-
-bool Value::is_nil() const { return m_type == ValueType::NIL; }
-
-bool Value::is_number() const { return m_type == ValueType::NUMBER; }
-
-bool Value::is_string() const { return m_type == ValueType::STRING; }
-
-bool Value::is_function() const { return m_type == ValueType::FUNCTION; }
-
-bool Value::is_native() const { return m_type == ValueType::NATIVE; }
-
-bool Value::is_closure() const { return m_type == ValueType::CLOSURE; }
-
-bool Value::is_upvalue() const { return m_type == ValueType::UPVALUE; }
-
-Value::operator bool() const { return !is_nil() and (!is_bool() or as_bool()); }
-
 bool Value::operator==(const Value &other) const {
+#ifndef LOX_TAGGED_UNION_VALUE
+    // Numbers need a floating point comparison (NaN != NaN, 0.0 == -0.0).
+    // Everything else is equal iff the bits are equal, except for ropes, which
+    // are the only strings that aren't interned.
+    if (is_number() and other.is_number()) {
+        return as_number() == other.as_number();
+    }
+    if (bits == other.bits) {
+        return true;
+    }
+    return is_string() and other.is_string() and
+           *as_string() == *other.as_string();
+#else
     if (m_type != other.m_type)
         return false;
     switch (m_type) {
@@ -86,8 +28,9 @@ bool Value::operator==(const Value &other) const {
     case ValueType::NUMBER:
         return as_number() == other.as_number();
     case ValueType::STRING:
-        // We are assuming string interning here!
-        return as_string() == other.as_string();
+        // Interned strings are compared by address.
+        return as_string() == other.as_string() or
+               *as_string() == *other.as_string();
     case ValueType::FUNCTION:
         return as_function() == other.as_function();
     case ValueType::NATIVE:
@@ -96,20 +39,23 @@ bool Value::operator==(const Value &other) const {
         return as_closure() == other.as_closure();
     case ValueType::UPVALUE:
         return as_upvalue() == other.as_upvalue();
+    case ValueType::UNDEFINED:
+        return true;
     }
 
     throw std::runtime_error("Unexpected Value type");
+#endif
 }
 
-void Value::mark() {
+void Value::mark(gc::GrayStack &gray) {
 #define MARK_AND_LOG(ptr)                                                      \
     {                                                                          \
-        ptr.mark();                                                            \
+        ptr.mark(gray);                                                        \
         if constexpr (DEBUG_LOG_GC) {                                          \
             std::cout << ptr.get() << " mark " << *this << "\n";               \
         }                                                                      \
     }
-    switch (m_type) {
+    switch (type()) {
     case ValueType::BOOL:
     case ValueType::NIL:
     case ValueType::NUMBER:
@@ -167,11 +113,14 @@ std::ostream &operator<<(std::ostream &os, const Value &value) {
         return os << Value(value.as_closure()->function);
     case ValueType::UPVALUE:
         return os << "upvalue";
+    case ValueType::UNDEFINED:
+        return os << "undefined";
     }
 
     throw std::runtime_error("Unexpected Value type");
 }
 
+#ifdef LOX_TAGGED_UNION_VALUE
 Value::ValueU::ValueU() : boolean(false) {}
 
 Value::ValueU::ValueU(bool boolean) : boolean(boolean) {}
@@ -187,3 +136,4 @@ Value::ValueU::ValueU(heap_ptr<ObjNative> native) : native(native) {}
 Value::ValueU::ValueU(heap_ptr<ObjClosure> closure) : closure(closure) {}
 
 Value::ValueU::ValueU(heap_ptr<ObjUpvalue> upvalue) : upvalue(upvalue) {}
+#endif
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <bit>
+#include <cstdint>
 #include <iostream>
+#include <type_traits>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "src/vm/gc/heap_obj.h"
@@ -18,8 +23,20 @@ enum struct ValueType {
     NATIVE,
     CLOSURE,
     UPVALUE,
+    // Sentinel held by global slots that are not defined (yet). Never visible
+    // to Lox code.
+    UNDEFINED,
 };
 
+/** `Value` has two interchangeable representations, selected at build time:
+ *
+ * - NaN boxing (default): a single 64-bit word. Doubles are stored as-is; every
+ *   other value is encoded inside the payload of a quiet NaN. Heap objects set
+ *   the sign bit, and use the low 3 bits of the (8-aligned) pointer as a tag
+ *   for the object type.
+ * - Tagged union (`--define value_repr=tagged_union`): a `ValueType` next to an
+ *   8-byte union.
+ */
 struct Value {
     /// @brief Initialize to nil.
     Value();
@@ -31,7 +48,7 @@ struct Value {
     Value(heap_ptr<ObjClosure> closure);
     Value(heap_ptr<ObjUpvalue> upvalue);
 
-    Value(const Value &other);
+    static Value undefined();
 
     ValueType type() const;
 
@@ -61,13 +78,15 @@ struct Value {
     bool is_native() const;
     bool is_closure() const;
     bool is_upvalue() const;
+    bool is_undefined() const;
 
     bool operator==(const Value &other) const;
 
     // For GC
-    void mark();
+    void mark(gc::GrayStack &gray);
 
   private:
+#ifdef LOX_TAGGED_UNION_VALUE
     ValueType m_type;
     union ValueU {
         bool boolean;
@@ -92,8 +111,229 @@ struct Value {
     // Apparently intellisense doesn't know this...
     static_assert(sizeof(ValueU) == sizeof(double));
 #endif
+#else
+    static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000;
+    static constexpr uint64_t OBJ_BITS = SIGN_BIT | QNAN;
+    static constexpr uint64_t TAG_MASK = 0x7;
+
+    static constexpr uint64_t NIL_BITS = QNAN | 1;
+    static constexpr uint64_t FALSE_BITS = QNAN | 2;
+    static constexpr uint64_t TRUE_BITS = QNAN | 3;
+    static constexpr uint64_t UNDEFINED_BITS = QNAN | 4;
+
+    enum ObjTag : uint64_t {
+        STRING_TAG,
+        FUNCTION_TAG,
+        NATIVE_TAG,
+        CLOSURE_TAG,
+        UPVALUE_TAG,
+    };
+
+    template <typename T>
+    static uint64_t box(heap_ptr<T> ptr, ObjTag tag) {
+        return OBJ_BITS | reinterpret_cast<uint64_t>(ptr.get()) | tag;
+    }
+    template <typename T>
+    heap_ptr<T> unbox() const {
+        return reinterpret_cast<HeapObj<T> *>(bits & ~(OBJ_BITS | TAG_MASK));
+    }
+    bool is_obj() const { return (bits & OBJ_BITS) == OBJ_BITS; }
+    bool is_obj(ObjTag tag) const {
+        return (bits & (OBJ_BITS | TAG_MASK)) == (OBJ_BITS | tag);
+    }
+
+    uint64_t bits;
+#endif
 };
 
+#ifndef LOX_TAGGED_UNION_VALUE
+static_assert(sizeof(Value) == sizeof(uint64_t));
+static_assert(sizeof(void *) == sizeof(uint64_t),
+              "NaN boxing requires 64-bit pointers.");
+#endif
+static_assert(std::is_trivially_copyable_v<Value>);
+
+#ifdef LOX_TAGGED_UNION_VALUE
+inline Value::Value() : m_type(ValueType::NIL) {}
+
+inline Value::Value(bool bool_val) : m_type(ValueType::BOOL), as(bool_val) {}
+
+inline Value::Value(double number) : m_type(ValueType::NUMBER), as(number) {}
+
+inline Value::Value(heap_ptr<ObjString> string)
+    : m_type(ValueType::STRING), as(string) {}
+
+inline Value::Value(heap_ptr<ObjFunction> function)
+    : m_type(ValueType::FUNCTION), as(function) {}
+
+inline Value::Value(heap_ptr<ObjNative> native)
+    : m_type(ValueType::NATIVE), as(native) {}
+
+inline Value::Value(heap_ptr<ObjClosure> closure)
+    : m_type(ValueType::CLOSURE), as(closure) {}
+
+inline Value::Value(heap_ptr<ObjUpvalue> upvalue)
+    : m_type(ValueType::UPVALUE), as(upvalue) {}
+
+inline Value Value::undefined() {
+    Value value;
+    value.m_type = ValueType::UNDEFINED;
+    return value;
+}
+
+inline ValueType Value::type() const { return m_type; }
+
+inline bool Value::as_bool() const { return as.boolean; }
+
+inline double Value::as_number() const { return as.number; }
+
+inline heap_ptr<ObjString> Value::as_string() const { return as.string; }
+
+inline heap_ptr<ObjFunction> Value::as_function() const { return as.function; }
+
+inline heap_ptr<ObjNative> Value::as_native() const { return as.native; }
+
+inline heap_ptr<ObjClosure> Value::as_closure() const { return as.closure; }
+
+inline heap_ptr<ObjUpvalue> Value::as_upvalue() const { return as.upvalue; }
+
+inline bool Value::is_bool() const { return m_type == ValueType::BOOL; }
+
+inline bool Value::is_nil() const { return m_type == ValueType::NIL; }
+
+inline bool Value::is_number() const { return m_type == ValueType::NUMBER; }
+
+inline bool Value::is_string() const { return m_type == ValueType::STRING; }
+
+inline bool Value::is_function() const {
+    return m_type == ValueType::FUNCTION;
+}
+
+inline bool Value::is_native() const { return m_type == ValueType::NATIVE; }
+
+inline bool Value::is_closure() const { return m_type == ValueType::CLOSURE; }
+
+inline bool Value::is_upvalue() const { return m_type == ValueType::UPVALUE; }
+
+inline bool Value::is_undefined() const {
+    return m_type == ValueType::UNDEFINED;
+}
+
+inline Value::operator bool() const {
+    return !is_nil() and (!is_bool() or as_bool());
+}
+#else
+inline Value::Value() : bits(NIL_BITS) {}
+
+inline Value::Value(bool bool_val) : bits(bool_val ? TRUE_BITS : FALSE_BITS) {}
+
+inline Value::Value(double number) : bits(std::bit_cast<uint64_t>(number)) {}
+
+inline Value::Value(heap_ptr<ObjString> string)
+    : bits(box(string, STRING_TAG)) {}
+
+inline Value::Value(heap_ptr<ObjFunction> function)
+    : bits(box(function, FUNCTION_TAG)) {}
+
+inline Value::Value(heap_ptr<ObjNative> native)
+    : bits(box(native, NATIVE_TAG)) {}
+
+inline Value::Value(heap_ptr<ObjClosure> closure)
+    : bits(box(closure, CLOSURE_TAG)) {}
+
+inline Value::Value(heap_ptr<ObjUpvalue> upvalue)
+    : bits(box(upvalue, UPVALUE_TAG)) {}
+
+inline Value Value::undefined() {
+    Value value;
+    value.bits = UNDEFINED_BITS;
+    return value;
+}
+
+inline ValueType Value::type() const {
+    if (is_number()) {
+        return ValueType::NUMBER;
+    }
+    if (is_obj()) {
+        switch (static_cast<ObjTag>(bits & TAG_MASK)) {
+        case STRING_TAG:
+            return ValueType::STRING;
+        case FUNCTION_TAG:
+            return ValueType::FUNCTION;
+        case NATIVE_TAG:
+            return ValueType::NATIVE;
+        case CLOSURE_TAG:
+            return ValueType::CLOSURE;
+        case UPVALUE_TAG:
+            return ValueType::UPVALUE;
+        }
+    }
+    if (is_undefined()) {
+        return ValueType::UNDEFINED;
+    }
+    return is_nil() ? ValueType::NIL : ValueType::BOOL;
+}
+
+inline bool Value::as_bool() const { return bits == TRUE_BITS; }
+
+inline double Value::as_number() const { return std::bit_cast<double>(bits); }
+
+inline heap_ptr<ObjString> Value::as_string() const {
+    return unbox<ObjString>();
+}
+
+inline heap_ptr<ObjFunction> Value::as_function() const {
+    return unbox<ObjFunction>();
+}
+
+inline heap_ptr<ObjNative> Value::as_native() const {
+    return unbox<ObjNative>();
+}
+
+inline heap_ptr<ObjClosure> Value::as_closure() const {
+    return unbox<ObjClosure>();
+}
+
+inline heap_ptr<ObjUpvalue> Value::as_upvalue() const {
+    return unbox<ObjUpvalue>();
+}
+
+inline bool Value::is_bool() const { return (bits | 1) == TRUE_BITS; }
+
+inline bool Value::is_nil() const { return bits == NIL_BITS; }
+
+inline bool Value::is_number() const { return (bits & QNAN) != QNAN; }
+
+inline bool Value::is_string() const { return is_obj(STRING_TAG); }
+
+inline bool Value::is_function() const { return is_obj(FUNCTION_TAG); }
+
+inline bool Value::is_native() const { return is_obj(NATIVE_TAG); }
+
+inline bool Value::is_closure() const { return is_obj(CLOSURE_TAG); }
+
+inline bool Value::is_upvalue() const { return is_obj(UPVALUE_TAG); }
+
+inline bool Value::is_undefined() const { return bits == UNDEFINED_BITS; }
+
+inline Value::operator bool() const {
+    return bits != NIL_BITS and bits != FALSE_BITS;
+}
+#endif
+
+inline Value::operator double() const { return as_number(); }
+
+inline Value::operator heap_ptr<ObjString>() const { return as_string(); }
+
+inline Value::operator heap_ptr<ObjFunction>() const { return as_function(); }
+
+inline Value::operator heap_ptr<ObjNative>() const { return as_native(); }
+
+inline Value::operator heap_ptr<ObjClosure>() const { return as_closure(); }
+
+inline Value::operator heap_ptr<ObjUpvalue>() const { return as_upvalue(); }
+
 using ValueArray = std::vector<Value>;
 
 std::ostream &operator<<(std::ostream &os, const Value &value);
@@ -102,15 +342,48 @@ constinit inline auto STRING_HASH = [](heap_ptr<ObjString> string) {
     return string->hash();
 };
 
+// Strings are interned, so comparing pointers is enough.
 constinit inline auto STRING_EQ = [](heap_ptr<ObjString> string1,
                                      heap_ptr<ObjString> string2) {
-    return *string1 == *string2;
+    return string1 == string2;
+};
+
+/** Characters looked up in the intern table, hashed once by the caller. */
+struct StringKey {
+    std::string_view chars;
+    object::hash_t hash;
+};
+
+struct InternHash {
+    using is_transparent = void;
+
+    object::hash_t operator()(heap_ptr<ObjString> string) const {
+        return string->hash();
+    }
+    object::hash_t operator()(const StringKey &key) const { return key.hash; }
+};
+
+struct InternEq {
+    using is_transparent = void;
+
+    bool operator()(heap_ptr<ObjString> string1,
+                    heap_ptr<ObjString> string2) const {
+        return string1 == string2;
+    }
+    bool operator()(const StringKey &key, heap_ptr<ObjString> string) const {
+        return key.hash == string->hash() and key.chars == string->str();
+    }
+    bool operator()(heap_ptr<ObjString> string, const StringKey &key) const {
+        return (*this)(key, string);
+    }
 };
 
-/** Used for string interning. */
-using StringMap = std::unordered_map<std::string, heap_ptr<ObjString>,
-                                     decltype(object::str_hash_func)>;
+/** Used for string interning. The table holds the strings themselves, and is
+ * looked up by `StringKey`, so the characters are only stored in the string.
+ */
+using StringSet = std::unordered_set<heap_ptr<ObjString>, InternHash, InternEq>;
 
-using VariableMap =
-    std::unordered_map<heap_ptr<ObjString>, Value, decltype(STRING_HASH),
-                       decltype(STRING_EQ)>;
+template <typename T>
+using StringKeyMap = std::unordered_map<heap_ptr<ObjString>, T,
+                                        decltype(STRING_HASH),
+                                        decltype(STRING_EQ)>;
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "src/vm/value.h"
+#include <limits>
 #include <string>
 
 TEST(ValueTests, TestValueString) {
@@ -10,4 +11,35 @@ TEST(ValueTests, TestValueString) {
     std::cout << val2 << std::endl;
     std::cout << val3 << std::endl;
     std::cout << val2 << std::endl;
-}
\ No newline at end of file
+}
+
+TEST(ValueTests, TestValueRoundTrip) {
+    EXPECT_TRUE(Value().is_nil());
+    EXPECT_EQ(Value().type(), ValueType::NIL);
+
+    EXPECT_TRUE(Value(true).is_bool());
+    EXPECT_TRUE(Value(true).as_bool());
+    EXPECT_FALSE(Value(false).as_bool());
+    EXPECT_FALSE(Value(false).is_nil());
+
+    for (double number : {0.0, -0.0, 1.5, -3.25, 1e300,
+                          std::numeric_limits<double>::infinity()}) {
+        Value value(number);
+        EXPECT_TRUE(value.is_number());
+        EXPECT_FALSE(value.is_bool() or value.is_nil() or value.is_string());
+        EXPECT_EQ(value.as_number(), number);
+    }
+
+    Value nan(std::numeric_limits<double>::quiet_NaN());
+    EXPECT_TRUE(nan.is_number());
+    EXPECT_FALSE(nan == nan);
+    EXPECT_TRUE(Value(0.0) == Value(-0.0));
+}
+
+TEST(ValueTests, TestValueTruthiness) {
+    EXPECT_FALSE(static_cast<bool>(Value()));
+    EXPECT_FALSE(static_cast<bool>(Value(false)));
+    EXPECT_TRUE(static_cast<bool>(Value(true)));
+    EXPECT_TRUE(static_cast<bool>(Value(0.0)));
+    EXPECT_FALSE(Value() == Value(false));
+}
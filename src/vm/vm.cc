@@ -1,33 +1,145 @@
 #include "vm.h"
 
 #include "src/compiler/compiler.h"
+#include "src/compiler/register_translator.h"
 #include "src/debug_flags.h"
 #include "src/vm/debug.h"
+#include "src/vm/gc/gc_stats.h"
 #include "src/vm/natives.h"
 #include "src/vm/obj_upvalue.h"
 
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <functional>
+#include <iterator>
+#include <new>
 #include <optional>
 
-VM::VM(InterpretMode interpret_mode)
-    : stack(new_gc_vector<Value>(
-          std::function<void(void)>(std::bind(&VM::collect_garbage, this)))),
-      m_interpret_mode(interpret_mode) {
+// Threaded (computed goto) dispatch relies on the GNU labels-as-values
+// extension. Fall back to a `switch` where it is unavailable, or when
+// explicitly requested with `--define dispatch=switch`.
+#ifndef LOX_COMPUTED_GOTO
+#if defined(__GNUC__) && !defined(LOX_SWITCH_DISPATCH)
+#define LOX_COMPUTED_GOTO 1
+#else
+#define LOX_COMPUTED_GOTO 0
+#endif
+#endif
+
+namespace {
+
+/** Reserve the VM stack. Pages are only backed by memory once the stack grows
+ * into them, so a deep stack costs nothing until it is used.
+ */
+Value *map_stack() {
+    void *memory = mmap(nullptr, STACK_MAX * sizeof(Value),
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    return static_cast<Value *>(memory);
+}
+
+} // namespace
+
+void VM::UnmapStack::operator()(Value *stack) const {
+    munmap(stack, STACK_MAX * sizeof(Value));
+}
+
+VM::VM(InterpretMode interpret_mode, ExecutionTier tier)
+    : stack(map_stack()), stack_top(stack.get()),
+      m_interpret_mode(interpret_mode), tier(tier),
+      frames(DEFAULT_MAX_FRAMES) {
+    heap_manager.get_heap().set_gc([this]() { collect_garbage(); });
     define_all_natives();
+    // The collector's stats so far, as JSON.
+    define_native("gcStats", {0, [this](std::span<Value>) {
+                      return Value(heap_manager.initialize(
+                          gc::stats_to_json(heap_manager.get_heap())));
+                  }});
+    if constexpr (DEBUG_COUNT_OPCODES) {
+        opcode_stats = std::make_unique<OpcodeStats>(
+            tier == ExecutionTier::STACK ? opcode_names()
+                                         : register_opcode_names());
+        // The stats so far, as JSON.
+        define_native("opcodeStats", {0, [this](std::span<Value>) {
+                          return Value(heap_manager.initialize(
+                              opcode_stats->to_json()));
+                      }});
+    }
+}
+
+VM::~VM() {
+    if constexpr (DEBUG_COUNT_OPCODES) {
+        const char *path = std::getenv("LOX_OPCODE_STATS");
+        if (path != nullptr and *path != '\0') {
+            std::ofstream out(path);
+            out << opcode_stats->to_json();
+            out.close();
+            if (!out) {
+                std::cerr << "Could not write the opcode stats to '" << path
+                          << "'." << std::endl;
+            }
+        }
+    }
 }
 
 InterpretResult VM::run_script(heap_ptr<ObjFunction> main) {
-    stack.emplace_back(main);
+    push(main);
     heap_ptr<ObjClosure> main_closure =
         heap_manager.initialize<ObjClosure>(main);
     pop();
     push(main_closure);
-    call(main_closure, 0);
-    InterpretResult result = run();
+    // Scripts the register tier can't translate run on the stack tier, so
+    // every valid script runs on both.
+    stack_fallback = tier == ExecutionTier::REGISTER and !translate_all(main);
+    if (stack_fallback) {
+        tier = ExecutionTier::STACK;
+    }
+    InterpretResult result = call(main_closure, 0)
+                                 ? run()
+                                 : InterpretResult::RUNTIME_ERROR;
+    if (stack_fallback) {
+        tier = ExecutionTier::REGISTER;
+        stack_fallback = false;
+    }
     return result;
 }
 
+__attribute__((always_inline)) inline bool
+VM::fast_call_registers(const Value &callee, int arg_count) {
+    if (!callee.is_closure()) {
+        return false;
+    }
+    heap_ptr<ObjClosure> closure = callee.as_closure();
+    const ObjFunction &function = *closure->function;
+    // Functions are translated by the slow path.
+    if (arg_count != function.arity or function.register_code == nullptr) {
+        return false;
+    }
+    const RegisterCode &code = *function.register_code;
+    Value *slots = stack_top - arg_count - 1;
+    Value *end = slots + code.frame_size;
+    if (frames.full() or end > stack.get() + STACK_MAX) {
+        return false;
+    }
+    std::fill(stack_top, end, Value());
+    Value *top = std::max(end, frames.back().top);
+    frames.emplace_back(closure, code.code.data(), slots, top);
+    stack_top = top;
+    return true;
+}
+
 InterpretResult VM::run() {
+    if (tier == ExecutionTier::REGISTER) {
+        return run_registers();
+    }
+
 #define RETURN_ERROR()                                                         \
     {                                                                          \
         result = InterpretResult::RUNTIME_ERROR;                               \
@@ -43,78 +155,146 @@ InterpretResult VM::run() {
         runtime_error("Operands must be numbers.");                            \
         return InterpretResult::RUNTIME_ERROR;                                 \
     }
+#define TRACE_INSTRUCTION()                                                    \
+    if constexpr (DEBUG_TRACE_EXECUTION) {                                     \
+        print_stack();                                                         \
+        disassemble_instruction(frame->chunk(),                                \
+                                frame->ip - frame->chunk().code.begin());      \
+    }                                                                          \
+    if constexpr (DEBUG_COUNT_OPCODES) {                                       \
+        if (!stack_fallback) {                                                 \
+            opcode_stats->count(static_cast<uint8_t>(frame->ip->opcode),       \
+                                frame);                                        \
+        }                                                                      \
+    }
 
     CallFrame *frame = &frames.back();
     InterpretResult result;
 
+#if LOX_COMPUTED_GOTO
+    // Threaded dispatch: every handler ends with its own indirect jump, so the
+    // branch predictor sees one jump site per opcode instead of a single shared
+    // one.
+    static void *const dispatch_table[] = {
+#define OPCODE_LABEL(op) &&op_##op,
+        LOX_OPCODES(OPCODE_LABEL)
+#undef OPCODE_LABEL
+    };
+    static_assert(std::size(dispatch_table) == OPCODE_COUNT);
+
+#define CASE(op) op_##op
+#define DISPATCH()                                                             \
+    {                                                                          \
+        TRACE_INSTRUCTION();                                                   \
+        goto *dispatch_table[static_cast<uint8_t>(read_byte(frame).opcode)];   \
+    }
+#define NEXT() DISPATCH()
+
+    DISPATCH();
+#else
+#define CASE(op) case OpCode::op
+#define NEXT() break
+
     // Breaking out of this loop is done using `goto`, because we don't want to
     // check a variable in every loop iteration.
     for (;;) {
-        if constexpr (DEBUG_TRACE_EXECUTION) {
-            print_stack();
-            disassemble_instruction(frame->chunk(),
-                                    frame->ip - frame->chunk().code.begin());
-        }
-        OpCode instruction;
+        TRACE_INSTRUCTION();
         // TODO: understand if functions here are inlined.
-        switch (instruction = read_byte(frame).opcode) {
-        case OpCode::CONSTANT: {
+        switch (read_byte(frame).opcode) {
+#endif
+        CASE(CONSTANT): {
             Value constant = read_constant(frame);
             push(constant);
-        } break;
-        case OpCode::DEFINE_GLOBAL: {
-            auto name = read_string(frame);
-            globals.emplace(name, peek(0));
-            pop();
-        } break;
-        case OpCode::GET_LOCAL: {
+            NEXT();
+        }
+        CASE(DEFINE_GLOBAL): {
+            global_ref_t slot = read_global(frame);
+            globals.values[slot] = pop();
+            globals.write_barrier(slot);
+            NEXT();
+        }
+        CASE(GET_LOCAL): {
             const_ref_t slot = read_byte(frame).constant_ref;
-            emplace(stack[frame->slots + slot]);
-        } break;
-        case OpCode::SET_LOCAL: {
+            push(frame->slots[slot]);
+            NEXT();
+        }
+        CASE(SET_LOCAL): {
             const_ref_t slot = read_byte(frame).constant_ref;
-            stack[frame->slots + slot] = peek(0);
-        } break;
-        case OpCode::GET_GLOBAL: {
-            auto name = read_string(frame);
-            if (!globals.contains(name)) {
-                runtime_error("Undefined variable '{}'.", name->str());
+            frame->slots[slot] = peek(0);
+            NEXT();
+        }
+        CASE(GET_GLOBAL): {
+            global_ref_t slot = read_global(frame);
+            const Value &value = globals.values[slot];
+            if (value.is_undefined()) {
+                runtime_error("Undefined variable '{}'.",
+                              globals.name(slot)->str());
                 RETURN_ERROR();
             }
-            push(globals.at(name));
-        } break;
-        case OpCode::SET_GLOBAL: {
-            auto name = read_string(frame);
-            auto name_it = globals.find(name);
-            if (name_it == globals.end()) {
-                runtime_error("Undefined variable '{}'.", name->str());
+            push(value);
+            NEXT();
+        }
+        CASE(SET_GLOBAL): {
+            global_ref_t slot = read_global(frame);
+            Value &value = globals.values[slot];
+            if (value.is_undefined()) {
+                runtime_error("Undefined variable '{}'.",
+                              globals.name(slot)->str());
                 RETURN_ERROR();
             }
-            auto &[_, value] = *name_it;
             value = peek(0);
-        } break;
-        case OpCode::GET_UPVALUE: {
+            globals.write_barrier(slot);
+            NEXT();
+        }
+        CASE(GET_UPVALUE): {
             const_ref_t slot = read_byte(frame).constant_ref;
-            push(frame->closure->upvalues[slot]->get(stack));
-        } break;
-        case OpCode::SET_UPVALUE: {
+            push(frame->closure->upvalues[slot]->get());
+            NEXT();
+        }
+        CASE(SET_UPVALUE): {
             const_ref_t slot = read_byte(frame).constant_ref;
-            frame->closure->upvalues[slot]->get(stack) = peek();
-        } break;
-        case OpCode::EQUAL: {
+            heap_ptr<ObjUpvalue> upvalue = frame->closure->upvalues[slot];
+            upvalue->get() = peek();
+            heap_manager.get_heap().write_barrier(upvalue.get(), peek());
+            NEXT();
+        }
+        CASE(EQUAL): {
             Value b = pop();
             Value a = pop();
             emplace(a == b);
-        } break;
-        case OpCode::GREATER:
+            NEXT();
+        }
+        CASE(NOT_EQUAL): {
+            Value b = pop();
+            Value a = pop();
+            emplace(!(a == b));
+            NEXT();
+        }
+        // `a >= b` is `!(a < b)`, which differs for NaN.
+        CASE(GREATER_EQUAL): {
+            ASSERT_NUMS();
+            double b = pop().as_number();
+            double a = pop().as_number();
+            emplace(!(a < b));
+            NEXT();
+        }
+        CASE(LESS_EQUAL): {
+            ASSERT_NUMS();
+            double b = pop().as_number();
+            double a = pop().as_number();
+            emplace(!(a > b));
+            NEXT();
+        }
+        CASE(GREATER):
             ASSERT_NUMS();
             binary_func<double, std::greater>();
-            break;
-        case OpCode::LESS:
+            NEXT();
+        CASE(LESS):
             ASSERT_NUMS();
             binary_func<double, std::less>();
-            break;
-        case OpCode::ADD:
+            NEXT();
+        CASE(ADD):
+        ADD_VALUES:
             if (peek(0).is_string() and peek(1).is_string()) {
                 binary_func<heap_ptr<ObjString>, std::plus>();
             } else if (peek(0).is_number() and peek(1).is_number()) {
@@ -123,62 +303,107 @@ InterpretResult VM::run() {
                 runtime_error("Operands must be two numbers or two strings.");
                 RETURN_ERROR();
             }
-            break;
-        case OpCode::SUBTRACT:
+            NEXT();
+        CASE(ADD_LOCAL_CONST): {
+            Value a = frame->slots[read_byte(frame).constant_ref];
+            Value b = read_constant(frame);
+            if (a.is_number() and b.is_number()) {
+                emplace(a.as_number() + b.as_number());
+                NEXT();
+            }
+            push(a);
+            push(b);
+            goto ADD_VALUES;
+        }
+        CASE(SUBTRACT):
             ASSERT_NUMS();
             binary_func<double, std::minus>();
-            break;
-        case OpCode::MULTIPLY:
+            NEXT();
+        CASE(MULTIPLY):
             ASSERT_NUMS();
             binary_func<double, std::multiplies>();
-            break;
-        case OpCode::DIVIDE:
+            NEXT();
+        CASE(DIVIDE):
             ASSERT_NUMS();
             binary_func<double, std::divides>();
-            break;
-        case OpCode::NOT:
+            NEXT();
+        CASE(NOT):
             emplace(!static_cast<bool>(pop()));
-            break;
-        case OpCode::NEGATE:
+            NEXT();
+        CASE(NEGATE):
             ASSERT_NUM();
             emplace(-pop().as_number());
-            break;
-        case OpCode::PRINT:
+            NEXT();
+        CASE(PRINT):
             std::cout << pop() << "\n";
-            break;
-        case OpCode::POP:
+            NEXT();
+        CASE(POP):
             pop();
-            break;
-        case OpCode::NIL:
+            NEXT();
+        CASE(POPN):
+            stack_top -= read_byte(frame).constant_ref;
+            NEXT();
+        CASE(NIL):
             emplace();
-            break;
-        case OpCode::TRUE:
+            NEXT();
+        CASE(TRUE):
             emplace(true);
-            break;
-        case OpCode::FALSE:
+            NEXT();
+        CASE(FALSE):
             emplace(false);
-            break;
-        case OpCode::JUMP: {
+            NEXT();
+        CASE(JUMP): {
             jump_off_t offset = read_jump(frame);
             frame->ip += offset;
-        } break;
-        case OpCode::JUMP_IF_FALSE: {
+            NEXT();
+        }
+        CASE(JUMP_IF_FALSE): {
             jump_off_t offset = read_jump(frame);
             if (!static_cast<bool>(peek(0))) {
                 frame->ip += offset;
             }
-        } break;
-        case OpCode::JUMP_IF_TRUE: {
+            NEXT();
+        }
+        CASE(JUMP_IF_FALSE_POP): {
+            jump_off_t offset = read_jump(frame);
+            if (!static_cast<bool>(pop())) {
+                frame->ip += offset;
+            }
+            NEXT();
+        }
+        CASE(JUMP_IF_NOT_LESS): {
+            ASSERT_NUMS();
+            jump_off_t offset = read_jump(frame);
+            double b = pop().as_number();
+            double a = pop().as_number();
+            if (!(a < b)) {
+                frame->ip += offset;
+            }
+            NEXT();
+        }
+        CASE(JUMP_IF_NOT_GREATER): {
+            ASSERT_NUMS();
+            jump_off_t offset = read_jump(frame);
+            double b = pop().as_number();
+            double a = pop().as_number();
+            if (!(a > b)) {
+                frame->ip += offset;
+            }
+            NEXT();
+        }
+        CASE(JUMP_IF_TRUE): {
             jump_off_t offset = read_jump(frame);
             if (static_cast<bool>(peek(0))) {
                 frame->ip += offset;
             }
-        } break;
-        case OpCode::LOOP: {
+            NEXT();
+        }
+        CASE(LOOP): {
             jump_off_t offset = read_jump(frame);
             frame->ip -= offset;
-        } break;
-        case OpCode::CALL: {
+            NEXT();
+        }
+        CASE(CALL): {
             const_ref_t arg_count = read_byte(frame).constant_ref;
             // peek(arg_count) is the function that is being called.
             if (!call_value(peek(arg_count), arg_count)) {
@@ -186,70 +411,425 @@ InterpretResult VM::run() {
             }
             // This is the "jump".
             frame = &frames.back();
-        } break;
-        case OpCode::CLOSURE: {
-            auto function = read_constant(frame).as_function();
-            heap_ptr<ObjClosure> closure =
-                heap_manager.initialize<ObjClosure>(function);
-            push(closure);
-
-            for (const_ref_t i = 0; i < closure->upvalue_count; ++i) {
-                bool is_local =
-                    static_cast<bool>(read_byte(frame).constant_ref);
-                const_ref_t index = read_byte(frame).constant_ref;
-                if (is_local) {
-                    closure->upvalues.push_back(
-                        capture_upvalue(frame->slots + index));
-                } else {
-                    closure->upvalues.push_back(frame->closure->upvalues[i]);
+            NEXT();
+        }
+        CASE(TAIL_CALL): {
+            const_ref_t arg_count = read_byte(frame).constant_ref;
+            Value callee = peek(arg_count);
+            // Otherwise the RETURN after this returns the call's result.
+            if (!tail_call(callee, arg_count) and
+                !call_value(callee, arg_count)) {
+                RETURN_ERROR();
+            }
+            frame = &frames.back();
+            NEXT();
+        }
+        CASE(CLOSURE):
+            push_closure(frame, read_constant(frame).as_function());
+            NEXT();
+        CASE(WIDE): {
+            // The same instructions, with an operand that didn't fit.
+            OpCode instruction = read_byte(frame).opcode;
+            wide_ref_t operand = read_wide(frame);
+            switch (instruction) {
+            case OpCode::CONSTANT:
+                push(frame->chunk().constants[operand]);
+                break;
+            case OpCode::CLOSURE:
+                push_closure(frame,
+                             frame->chunk().constants[operand].as_function());
+                break;
+            case OpCode::JUMP:
+                frame->ip += operand;
+                break;
+            case OpCode::JUMP_IF_FALSE:
+                if (!static_cast<bool>(peek(0))) {
+                    frame->ip += operand;
+                }
+                break;
+            case OpCode::JUMP_IF_FALSE_POP:
+                if (!static_cast<bool>(pop())) {
+                    frame->ip += operand;
                 }
+                break;
+            case OpCode::JUMP_IF_TRUE:
+                if (static_cast<bool>(peek(0))) {
+                    frame->ip += operand;
+                }
+                break;
+            case OpCode::JUMP_IF_NOT_LESS:
+            case OpCode::JUMP_IF_NOT_GREATER: {
+                ASSERT_NUMS();
+                double b = pop().as_number();
+                double a = pop().as_number();
+                if (instruction == OpCode::JUMP_IF_NOT_LESS ? !(a < b)
+                                                            : !(a > b)) {
+                    frame->ip += operand;
+                }
+                break;
             }
-        } break;
-        case OpCode::CLOSE_UPVALUE:
-            close_upvalues(stack.size() - 1);
+            case OpCode::LOOP:
+                frame->ip -= operand;
+                break;
+            default:
+                __builtin_unreachable();
+            }
+            NEXT();
+        }
+        CASE(CLOSE_UPVALUE):
+            close_upvalues(stack_top - 1);
             pop();
-            break;
-        case OpCode::RETURN: {
+            NEXT();
+        CASE(RETURN): {
             Value returned = pop();
-            size_t last_slot = frame->slots;
+            Value *last_slot = frame->slots;
             close_upvalues(last_slot);
 
             // After this, `frame` is invalidated!
             frames.pop_back();
 
-            if (frames.size() == 0) {
+            if (frames.empty()) {
                 pop();
                 result = InterpretResult::OK;
                 goto DONE;
             }
-            stack.resize(last_slot);
+            stack_top = last_slot;
             push(returned);
             frame = &frames.back();
-        } break;
+            NEXT();
+        }
+#if !LOX_COMPUTED_GOTO
         }
     }
+#endif
 DONE:
     return result;
+#undef NEXT
+#undef CASE
+#if LOX_COMPUTED_GOTO
+#undef DISPATCH
+#endif
+#undef TRACE_INSTRUCTION
 #undef ASSERT_NUM
 #undef ASSERT_NUMS
 #undef RETURN_ERROR
 }
 
-void VM::push(const Value &value) { stack.push_back(value); }
+InterpretResult VM::run_registers() {
+#define RUNTIME_ERROR(...)                                                     \
+    {                                                                          \
+        frame->reg_ip = ip;                                                    \
+        runtime_error(__VA_ARGS__);                                            \
+        return InterpretResult::RUNTIME_ERROR;                                 \
+    }
+#define RK(operand)                                                            \
+    ((operand) & K_BIT ? constants[(operand) & ~K_BIT] : regs[operand])
+#define NUMBER_OPERAND()                                                       \
+    const Value &x = RK(instruction.b);                                        \
+    if (!x.is_number()) {                                                      \
+        RUNTIME_ERROR("Operand must be a number.");                            \
+    }
+#define NUMBER_OPERANDS()                                                      \
+    const Value &x = RK(instruction.b);                                        \
+    const Value &y = RK(instruction.c);                                        \
+    if (!x.is_number() || !y.is_number()) {                                    \
+        RUNTIME_ERROR("Operands must be numbers.");                            \
+    }
+#define LOAD_FRAME()                                                           \
+    {                                                                          \
+        frame = &frames.back();                                                \
+        ip = frame->reg_ip;                                                    \
+        regs = frame->slots;                                                   \
+        constants = frame->chunk().constants.data();                           \
+    }
+#define TRACE_INSTRUCTION()                                                    \
+    if constexpr (DEBUG_TRACE_EXECUTION) {                                     \
+        const RegisterCode &code = *frame->closure->function->register_code;   \
+        print_registers(*frame);                                               \
+        disassemble_register_instruction(code, frame->chunk(),                 \
+                                         ip - code.code.data());               \
+    }                                                                          \
+    if constexpr (DEBUG_COUNT_OPCODES) {                                       \
+        opcode_stats->count(static_cast<uint8_t>(ip->opcode), frame);          \
+    }
 
-Value VM::pop() {
-    Value popped = stack.back();
-    stack.pop_back();
-    return popped;
-}
+    CallFrame *frame;
+    // Cached copies of the frame's fields.
+    const RegInstruction *ip;
+    Value *regs;
+    const Value *constants;
+    RegInstruction instruction;
+    LOAD_FRAME();
+
+#if LOX_COMPUTED_GOTO
+    static void *const dispatch_table[] = {
+#define OPCODE_LABEL(op) &&op_##op,
+        LOX_REG_OPCODES(OPCODE_LABEL)
+#undef OPCODE_LABEL
+    };
+    static_assert(std::size(dispatch_table) == REG_OPCODE_COUNT);
+
+#define CASE(op) op_##op
+#define NEXT()                                                                 \
+    {                                                                          \
+        TRACE_INSTRUCTION();                                                   \
+        instruction = *ip++;                                                   \
+        goto *dispatch_table[static_cast<uint8_t>(instruction.opcode)];        \
+    }
+
+    NEXT();
+#else
+#define CASE(op) case RegOpCode::op
+#define NEXT() break
+
+    for (;;) {
+        TRACE_INSTRUCTION();
+        instruction = *ip++;
+        switch (instruction.opcode) {
+#endif
+        CASE(MOVE):
+            regs[instruction.a] = RK(instruction.b);
+            NEXT();
+        CASE(NIL):
+            regs[instruction.a] = Value();
+            NEXT();
+        CASE(TRUE):
+            regs[instruction.a] = Value(true);
+            NEXT();
+        CASE(FALSE):
+            regs[instruction.a] = Value(false);
+            NEXT();
+        CASE(EQUAL):
+            regs[instruction.a] =
+                Value(RK(instruction.b) == RK(instruction.c));
+            NEXT();
+        CASE(NOT_EQUAL):
+            regs[instruction.a] =
+                Value(!(RK(instruction.b) == RK(instruction.c)));
+            NEXT();
+        CASE(GREATER): {
+            NUMBER_OPERANDS();
+            regs[instruction.a] = Value(x.as_number() > y.as_number());
+            NEXT();
+        }
+        CASE(LESS): {
+            NUMBER_OPERANDS();
+            regs[instruction.a] = Value(x.as_number() < y.as_number());
+            NEXT();
+        }
+        // `a >= b` is `!(a < b)`, which differs for NaN.
+        CASE(GREATER_EQUAL): {
+            NUMBER_OPERANDS();
+            regs[instruction.a] = Value(!(x.as_number() < y.as_number()));
+            NEXT();
+        }
+        CASE(LESS_EQUAL): {
+            NUMBER_OPERANDS();
+            regs[instruction.a] = Value(!(x.as_number() > y.as_number()));
+            NEXT();
+        }
+        CASE(ADD): {
+            const Value &x = RK(instruction.b);
+            const Value &y = RK(instruction.c);
+            if (x.is_number() and y.is_number()) {
+                regs[instruction.a] = Value(x.as_number() + y.as_number());
+            } else if (x.is_string() and y.is_string()) {
+                regs[instruction.a] =
+                    heap_manager.concatenate(x.as_string(), y.as_string());
+            } else {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
+            }
+            NEXT();
+        }
+        CASE(SUBTRACT): {
+            NUMBER_OPERANDS();
+            regs[instruction.a] = Value(x.as_number() - y.as_number());
+            NEXT();
+        }
+        CASE(MULTIPLY): {
+            NUMBER_OPERANDS();
+            regs[instruction.a] = Value(x.as_number() * y.as_number());
+            NEXT();
+        }
+        CASE(DIVIDE): {
+            NUMBER_OPERANDS();
+            regs[instruction.a] = Value(x.as_number() / y.as_number());
+            NEXT();
+        }
+        CASE(NOT):
+            regs[instruction.a] = Value(!static_cast<bool>(RK(instruction.b)));
+            NEXT();
+        CASE(NEGATE): {
+            NUMBER_OPERAND();
+            regs[instruction.a] = Value(-x.as_number());
+            NEXT();
+        }
+        CASE(DEFINE_GLOBAL):
+            globals.values[instruction.a] = RK(instruction.b);
+            globals.write_barrier(instruction.a);
+            NEXT();
+        CASE(SET_GLOBAL): {
+            Value &value = globals.values[instruction.a];
+            if (value.is_undefined()) {
+                RUNTIME_ERROR("Undefined variable '{}'.",
+                              globals.name(instruction.a)->str());
+            }
+            value = RK(instruction.b);
+            globals.write_barrier(instruction.a);
+            NEXT();
+        }
+        CASE(GET_GLOBAL): {
+            const Value &value = globals.values[instruction.b];
+            if (value.is_undefined()) {
+                RUNTIME_ERROR("Undefined variable '{}'.",
+                              globals.name(instruction.b)->str());
+            }
+            regs[instruction.a] = value;
+            NEXT();
+        }
+        CASE(SET_UPVALUE): {
+            heap_ptr<ObjUpvalue> upvalue =
+                frame->closure->upvalues[instruction.a];
+            upvalue->get() = RK(instruction.b);
+            heap_manager.get_heap().write_barrier(upvalue.get(),
+                                                  RK(instruction.b));
+            NEXT();
+        }
+        CASE(GET_UPVALUE):
+            regs[instruction.a] =
+                frame->closure->upvalues[instruction.b]->get();
+            NEXT();
+        CASE(PRINT):
+            std::cout << RK(instruction.b) << "\n";
+            NEXT();
+        CASE(JUMP):
+            ip += instruction.wide_a();
+            NEXT();
+        CASE(LOOP):
+            ip -= instruction.wide_a();
+            NEXT();
+        CASE(JUMP_IF_FALSE):
+            if (!static_cast<bool>(RK(instruction.b))) {
+                ip += instruction.wide_a();
+            }
+            NEXT();
+        CASE(JUMP_IF_TRUE):
+            if (static_cast<bool>(RK(instruction.b))) {
+                ip += instruction.wide_a();
+            }
+            NEXT();
+        CASE(JUMP_IF_NOT_LESS): {
+            NUMBER_OPERANDS();
+            if (!(x.as_number() < y.as_number())) {
+                ip += instruction.wide_a();
+            }
+            NEXT();
+        }
+        CASE(JUMP_IF_NOT_GREATER): {
+            NUMBER_OPERANDS();
+            if (!(x.as_number() > y.as_number())) {
+                ip += instruction.wide_a();
+            }
+            NEXT();
+        }
+        CASE(CALL): {
+            frame->reg_ip = ip;
+            // Calls take their arguments from the top of the stack, and the
+            // registers above them are dead anyway.
+            stack_top = regs + instruction.a + instruction.b + 1;
+            const Value &callee = regs[instruction.a];
+            if (!fast_call_registers(callee, instruction.b) and
+                !call_value(callee, instruction.b)) {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            stack_top = frame->top;
+            NEXT();
+        }
+        CASE(TAIL_CALL): {
+            frame->reg_ip = ip;
+            stack_top = regs + instruction.a + instruction.b + 1;
+            Value callee = regs[instruction.a];
+            // Otherwise the RETURN after this returns the call's result.
+            if (!tail_call_registers(callee, instruction.b) and
+                !fast_call_registers(callee, instruction.b) and
+                !call_value(callee, instruction.b)) {
+                return InterpretResult::RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            stack_top = frame->top;
+            NEXT();
+        }
+        CASE(CLOSURE): {
+            auto function = constants[instruction.wide_b()].as_function();
+            heap_ptr<ObjClosure> closure =
+                heap_manager.initialize<ObjClosure>(function);
+            regs[instruction.a] = closure;
+
+            for (const_ref_t i = 0; i < closure->upvalue_count; ++i) {
+                const RegInstruction &capture = *ip++;
+                heap_ptr<ObjUpvalue> upvalue =
+                    capture.a ? capture_upvalue(regs + capture.b)
+                              : frame->closure->upvalues[capture.b];
+                closure->upvalues.push_back(upvalue);
+                // Capturing an upvalue might have promoted the closure.
+                heap_manager.get_heap().write_barrier(closure.get(), upvalue);
+            }
+            NEXT();
+        }
+        // Only an operand of CLOSURE, which skips it.
+        CASE(CAPTURE):
+            NEXT();
+        CASE(CLOSE_UPVALUE):
+            close_upvalues(regs + instruction.a);
+            NEXT();
+        CASE(LOAD_CONSTANT):
+            regs[instruction.a] = constants[instruction.wide_b()];
+            NEXT();
+        CASE(RETURN): {
+            Value returned = RK(instruction.b);
+            close_upvalues(regs);
 
-Value VM::peek(int distance) const { return *(stack.rbegin() + distance); }
+            // After this, `frame` is invalidated!
+            frames.pop_back();
+
+            if (frames.empty()) {
+                stack_top = regs;
+                return InterpretResult::OK;
+            }
+            // The callee's register 0 is the caller's destination register.
+            regs[0] = returned;
+            LOAD_FRAME();
+            stack_top = frame->top;
+            NEXT();
+        }
+#if !LOX_COMPUTED_GOTO
+        }
+    }
+#endif
+#undef NEXT
+#undef CASE
+#undef TRACE_INSTRUCTION
+#undef LOAD_FRAME
+#undef NUMBER_OPERANDS
+#undef NUMBER_OPERAND
+#undef RK
+#undef RUNTIME_ERROR
+}
 
 HeapManager &VM::get_heap_manager() { return heap_manager; }
 
+Globals &VM::get_globals() { return globals; }
+
+const FrameStack &VM::get_frames() const { return frames; }
+
 InterpretMode VM::interpret_mode() const { return m_interpret_mode; }
 
-void VM::reset_stack() { stack.clear(); }
+void VM::set_max_frames(size_t max_frames) {
+    frames.set_max_frames(max_frames);
+}
+
+void VM::reset_stack() { stack_top = stack.get(); }
 
 jump_off_t VM::read_jump(CallFrame *frame) {
     jump_off_t ret = get_jump_off(frame->ip);
@@ -257,17 +837,28 @@ jump_off_t VM::read_jump(CallFrame *frame) {
     return ret;
 }
 
-Value VM::read_constant(CallFrame *frame) {
-    return frame->chunk().constants[read_byte(frame).constant_ref];
+global_ref_t VM::read_global(CallFrame *frame) {
+    global_ref_t ret = get_global_ref(frame->ip);
+    frame->ip += sizeof(global_ref_t);
+    return ret;
+}
+
+wide_ref_t VM::read_wide(CallFrame *frame) {
+    wide_ref_t ret = get_wide_ref(frame->ip);
+    frame->ip += sizeof(wide_ref_t);
+    return ret;
 }
 
-heap_ptr<ObjString> VM::read_string(CallFrame *frame) {
-    return read_constant(frame).as_string();
+Value VM::read_constant(CallFrame *frame) {
+    return frame->chunk().constants[read_byte(frame).constant_ref];
 }
 
 void VM::define_native(const std::string &name, const ObjNative &native) {
-    globals.emplace(heap_manager.initialize(name),
-                    heap_manager.initialize<ObjNative>(native));
+    // Natives are defined before anything is compiled, so they get the first
+    // global slots.
+    global_ref_t slot = globals.resolve(heap_manager.initialize(name)).value();
+    globals.values[slot] = heap_manager.initialize<ObjNative>(native);
+    globals.write_barrier(slot);
 }
 
 void VM::define_all_natives() {
@@ -293,6 +884,27 @@ bool VM::call_value(const Value &callee, int arg_count) {
 }
 
 bool VM::call(heap_ptr<ObjClosure> closure, int arg_count) {
+    if (tier == ExecutionTier::REGISTER) {
+        return call_registers(closure, arg_count);
+    }
+    auto function = closure->function;
+    if (arg_count != function->arity) {
+        runtime_error("Expected {} arguments but got {}.", function->arity,
+                      arg_count);
+        return false;
+    }
+
+    Value *slots = stack_top - arg_count - 1;
+    if (frames.full() or
+        slots + FRAME_SLOTS > stack.get() + STACK_MAX) {
+        runtime_error("Stack overflow.");
+        return false;
+    }
+    frames.emplace_back(closure, function->chunk.code.begin(), slots);
+    return true;
+}
+
+bool VM::call_registers(heap_ptr<ObjClosure> closure, int arg_count) {
     auto function = closure->function;
     if (arg_count != function->arity) {
         runtime_error("Expected {} arguments but got {}.", function->arity,
@@ -300,12 +912,99 @@ bool VM::call(heap_ptr<ObjClosure> closure, int arg_count) {
         return false;
     }
 
-    if (frames.size() == FRAMES_MAX) {
+    if (!translate(function)) {
+        runtime_error("Function is too large for the register tier.");
+        return false;
+    }
+    const RegisterCode &code = *function->register_code;
+
+    // As in the stack tier, the callee and its arguments are on top.
+    Value *slots = stack_top - arg_count - 1;
+    Value *end = slots + code.frame_size;
+    if (frames.full() or end > stack.get() + STACK_MAX) {
         runtime_error("Stack overflow.");
         return false;
     }
-    frames.emplace_back(closure, function->chunk.code.begin(),
-                        stack.end() - arg_count - 1 - stack.begin());
+    // Registers are all GC roots, so they must not hold stale values.
+    std::fill(stack_top, end, Value());
+    Value *top = frames.empty() ? end : std::max(end, frames.back().top);
+    frames.emplace_back(closure, code.code.data(), slots, top);
+    stack_top = top;
+    return true;
+}
+
+bool VM::tail_call(const Value &callee, int arg_count) {
+    if (!callee.is_closure() or
+        callee.as_closure()->function->arity != arg_count) {
+        return false;
+    }
+    heap_ptr<ObjClosure> closure = callee.as_closure();
+    CallFrame &frame = frames.back();
+    // The callee and its arguments take the place of the caller's window.
+    close_upvalues(frame.slots);
+    stack_top = std::copy(stack_top - arg_count - 1, stack_top, frame.slots);
+    frame.closure = closure;
+    frame.ip = closure->function->chunk.code.begin();
+    frame.tail_called = true;
+    return true;
+}
+
+bool VM::tail_call_registers(const Value &callee, int arg_count) {
+    if (!callee.is_closure()) {
+        return false;
+    }
+    heap_ptr<ObjClosure> closure = callee.as_closure();
+    if (arg_count != closure->function->arity or
+        !translate(closure->function)) {
+        return false;
+    }
+    const RegisterCode &code = *closure->function->register_code;
+    CallFrame &frame = frames.back();
+    Value *end = frame.slots + code.frame_size;
+    if (end > stack.get() + STACK_MAX) {
+        return false;
+    }
+    close_upvalues(frame.slots);
+    Value *args_end =
+        std::copy(stack_top - arg_count - 1, stack_top, frame.slots);
+    std::fill(args_end, end, Value());
+    frame.top = frames.size() == 1
+                    ? end
+                    : std::max(end, frames[frames.size() - 2].top);
+    frame.closure = closure;
+    frame.reg_ip = code.code.data();
+    frame.tail_called = true;
+    return true;
+}
+
+bool VM::translate(heap_ptr<ObjFunction> function) {
+    if (function->register_code != nullptr) {
+        return true;
+    }
+    std::optional<RegisterCode> code =
+        translate_to_registers(function->chunk, function->arity);
+    if (!code.has_value()) {
+        return false;
+    }
+    function->register_code =
+        std::make_unique<RegisterCode>(std::move(code.value()));
+    if constexpr (DEBUG_PRINT_CODE) {
+        disassemble_register_code(
+            *function->register_code, function->chunk,
+            function->name == nullptr ? "<script>" : function->name->str());
+    }
+    return true;
+}
+
+bool VM::translate_all(heap_ptr<ObjFunction> function) {
+    if (!translate(function)) {
+        return false;
+    }
+    for (const Value &constant : function->chunk.constants) {
+        if (constant.is_function() and !translate_all(constant.as_function())) {
+            return false;
+        }
+    }
     return true;
 }
 
@@ -317,97 +1016,201 @@ bool VM::call_native(heap_ptr<ObjNative> native_fn, int arg_count) {
     }
     using span_size = std::span<Value>::size_type;
     Value result = std::invoke(
-        native_fn->fun, std::span<Value>{&stack.back() - arg_count,
+        native_fn->fun, std::span<Value>{stack_top - arg_count,
                                          static_cast<span_size>(arg_count)});
     // The -1 is to pop the function call itself.
-    stack.resize(stack.size() - (arg_count + 1));
+    stack_top -= arg_count + 1;
     push(result);
     return true;
 }
 
-heap_ptr<ObjUpvalue> VM::capture_upvalue(size_t stack_index) {
-    /* The open_upvalues array is kept sorted from highest index to lowest.
-    When searching for an existing index, we search for the first index that is
-    lower (or equal) than the given index. */
+void VM::push_closure(CallFrame *frame, heap_ptr<ObjFunction> function) {
+    heap_ptr<ObjClosure> closure = heap_manager.initialize<ObjClosure>(function);
+    push(closure);
+
+    for (const_ref_t i = 0; i < closure->upvalue_count; ++i) {
+        bool is_local = static_cast<bool>(read_byte(frame).constant_ref);
+        const_ref_t index = read_byte(frame).constant_ref;
+        heap_ptr<ObjUpvalue> upvalue =
+            is_local ? capture_upvalue(frame->slots + index)
+                     : frame->closure->upvalues[index];
+        closure->upvalues.push_back(upvalue);
+        // Capturing an upvalue might have promoted the closure.
+        heap_manager.get_heap().write_barrier(closure.get(), upvalue);
+    }
+}
+
+heap_ptr<ObjUpvalue> VM::capture_upvalue(Value *local) {
+    /* The open_upvalues array is kept sorted from highest slot to lowest.
+    When searching for an existing slot, we search for the first slot that is
+    lower (or equal) than the given slot. */
     decltype(open_upvalues)::const_iterator upvalue = open_upvalues.begin(),
                                             upvalue_prev =
                                                 open_upvalues.before_begin();
 
-    while (upvalue != open_upvalues.end() and (*upvalue)->index > stack_index) {
+    while (upvalue != open_upvalues.end() and (*upvalue)->location > local) {
         upvalue_prev = upvalue;
         ++upvalue;
     }
 
-    if (upvalue != open_upvalues.end() and (*upvalue)->index == stack_index) {
+    if (upvalue != open_upvalues.end() and (*upvalue)->location == local) {
         return *upvalue;
     }
 
-    auto created_upvalue = heap_manager.initialize<ObjUpvalue>(stack_index);
+    auto created_upvalue = heap_manager.initialize<ObjUpvalue>(local);
     open_upvalues.insert_after(upvalue_prev, created_upvalue);
     return created_upvalue;
 }
 
-void VM::close_upvalues(size_t last_index) {
-    while (!open_upvalues.empty() and
-           open_upvalues.front()->index >= last_index) {
+void VM::close_upvalues(Value *last) {
+    while (!open_upvalues.empty() and open_upvalues.front()->location >= last) {
         heap_ptr<ObjUpvalue> upvalue = open_upvalues.front();
         // yank!
-        upvalue->closed = upvalue->get(stack);
+        upvalue->close();
+        heap_manager.get_heap().write_barrier(upvalue.get(), upvalue->get());
         open_upvalues.erase_after(open_upvalues.before_begin());
     }
 }
 
-void VM::mark_globals() {
-    for (const auto &[name, value] : globals) {
-        const_cast<heap_ptr<ObjString> &>(name).mark();
-        // name is not a `Value` so we need to log its mark.
-        if constexpr (DEBUG_LOG_GC) {
-            std::cout << name.get() << " mark " << name->str() << "\n";
-        }
-        const_cast<Value &>(value).mark();
+void VM::mark_globals(gc::GrayStack &gray, bool dirty_globals_only) {
+    if (dirty_globals_only) {
+        globals.mark_dirty(gray);
+    } else {
+        globals.mark(gray);
     }
 
-    for (auto &frame : frames) {
-        frame.closure.mark();
+    for (size_t i = 0; i < frames.size(); ++i) {
+        frames[i].closure.mark(gray);
     }
 
     for (auto &upvalue : open_upvalues) {
-        upvalue.mark();
+        upvalue.mark(gray);
     }
 }
 
-void VM::mark_roots() {
-    for (auto &value : stack) {
-        value.mark();
+void VM::mark_roots(gc::GrayStack &gray, bool dirty_globals_only) {
+    for (Value *slot = stack.get(); slot < stack_top; ++slot) {
+        slot->mark(gray);
     }
 
-    mark_globals();
+    mark_globals(gray, dirty_globals_only);
+    heap_manager.mark_roots(gray);
 }
 
 void VM::collect_garbage() {
-    if constexpr (DEBUG_LOG_GC) {
-        std::cout << "-- gc begin\n";
+    if constexpr (DEBUG_COUNT_OPCODES) {
+        // Freed functions' addresses might be reused.
+        opcode_stats->forget_functions();
     }
+    Heap &heap = heap_manager.get_heap();
+    auto start = std::chrono::steady_clock::now();
+    size_t before = heap.get_bytes_allocated();
 
-    mark_roots();
+    if (heap.get_phase() == gc::Phase::SWEEPING) {
+        heap.sweep_slice();
+        if constexpr (DEBUG_LOG_GC) {
+            std::cout << "-- gc sweep slice\n";
+        }
+        // The nursery might be full as well.
+        if (!heap.collection_due()) {
+            heap.record_pause(std::chrono::steady_clock::now() - start);
+            return;
+        }
+    }
+    if (heap.get_phase() == gc::Phase::MARKING) {
+        if (!heap.mark_slice()) {
+            if constexpr (DEBUG_LOG_GC) {
+                std::cout << "-- gc mark slice\n";
+            }
+            heap.record_pause(std::chrono::steady_clock::now() - start);
+            return;
+        }
+        if constexpr (DEBUG_LOG_GC) {
+            std::cout << "-- gc finish marking\n";
+        }
+        // The stack and the other roots have no write barrier, so mark them
+        // again in one atomic pause. Globals only need their dirty slots.
+        gc::GrayStack &gray = heap.get_marking_gray();
+        mark_roots(gray, true);
+        heap_manager.collect(gray);
+    } else {
+        gc::Collection collection = heap.next_collection();
+        if constexpr (DEBUG_LOG_GC) {
+            std::cout << fmt::format(
+                "-- gc begin ({})\n",
+                collection == gc::Collection::MINOR ? "minor" : "major");
+        }
+
+        if (collection == gc::Collection::MAJOR and heap.is_incremental()) {
+            mark_roots(heap.begin_marking(), false);
+            heap.record_pause(std::chrono::steady_clock::now() - start);
+            return;
+        }
+        gc::GrayStack gray{collection};
+        mark_roots(gray, collection == gc::Collection::MINOR);
+        heap_manager.collect(gray);
+    }
+    heap.record_pause(std::chrono::steady_clock::now() - start);
 
     if constexpr (DEBUG_LOG_GC) {
         std::cout << "-- gc end\n";
+        std::cout << fmt::format(
+            "   collected {} bytes (from {} to {}) next at {}\n",
+            before - heap.get_bytes_allocated(), before,
+            heap.get_bytes_allocated(), heap.get_next_gc());
+    }
+}
+
+void VM::print_registers(const CallFrame &frame) const {
+    const RegisterCode &code = *frame.closure->function->register_code;
+    std::cout << "          ";
+    for (int i = 0; i < code.frame_size; ++i) {
+        std::cout << "[ " << frame.slots[i] << " ]";
+    }
+    std::cout << "\n";
+}
+
+void VM::print_stack_trace() {
+    // Frames printed at either end of a deep stack.
+    constexpr size_t EDGE_FRAMES = 32;
+    for (size_t i = frames.size(); i-- > 0;) {
+        if (i + EDGE_FRAMES + 1 == frames.size() and i >= EDGE_FRAMES) {
+            std::cerr << fmt::format("(...{} more frames...)\n",
+                                     i - EDGE_FRAMES + 1);
+            i = EDGE_FRAMES;
+            continue;
+        }
+        CallFrame &frame = frames[i];
+        auto function = frame.closure->function;
+        std::cerr << fmt::format("[line {}] in ", frame.current_line());
+        if (function->name == nullptr) {
+            std::cerr << "script\n";
+        } else {
+            std::cerr << fmt::format("{}()\n", function->name->str());
+        }
+        if (frame.tail_called) {
+            std::cerr << "(...tail calls...)\n";
+        }
     }
 }
 
 void VM::print_stack() const {
     std::cout << "          ";
-    for (const auto &value : stack) {
-        std::cout << "[ " << value << " ]";
+    for (const Value *slot = stack.get(); slot < stack_top; ++slot) {
+        std::cout << "[ " << *slot << " ]";
     }
     std::cout << "\n";
 }
 
-InterpretResult interpret(VM &vm, const std::string &source) {
+std::optional<heap_ptr<ObjFunction>> compile(VM &vm,
+                                             const std::string &source) {
     Parser parser{source};
-    Compiler compiler{vm.get_heap_manager(), parser};
-    auto func_opt = compiler.compile();
+    Compiler compiler{vm.get_heap_manager(), vm.get_globals(), parser};
+    return compiler.compile();
+}
+
+InterpretResult interpret(VM &vm, const std::string &source) {
+    auto func_opt = compile(vm, source);
 
     if (!func_opt.has_value()) {
         return InterpretResult::COMPILE_ERROR;
@@ -417,9 +1220,3 @@ InterpretResult interpret(VM &vm, const std::string &source) {
 
     return result;
 }
-
-CallFrame::CallFrame(heap_ptr<ObjClosure> closure, CodeVec::const_iterator ip,
-                     size_t slots)
-    : closure(closure), ip(std::move(ip)), slots(slots) {}
-
-Chunk &CallFrame::chunk() { return closure->function->chunk; }
@@ -1,57 +1,71 @@
 #pragma once
 
+#include "src/vm/call_frame.h"
 #include "src/vm/chunk.h"
-#include "src/vm/gc/gc_allocator.h"
 #include "src/vm/gc/heap.h"
 #include "src/vm/gc/heap_obj.h"
+#include "src/vm/globals.h"
 #include "src/vm/heap_manager.h"
 #include "src/vm/obj_function.h"
 #include "src/vm/object.h"
+#include "src/vm/opcode_stats.h"
+#include "src/vm/register_code.h"
 #include "src/vm/value.h"
 
 #include <fmt/format.h>
 #include <forward_list>
 #include <functional>
-#include <ranges>
+#include <limits>
+#include <memory>
+#include <optional>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
-constexpr int FRAMES_MAX = 64;
+/** Default limit on the depth of calls. */
+constexpr size_t DEFAULT_MAX_FRAMES = 1 << 22;
+// Stack slots guaranteed to every frame: enough for the maximal number of
+// locals.
+constexpr int FRAME_SLOTS = std::numeric_limits<const_ref_t>::max() + 1;
+// Slots of the VM stack. Its memory is reserved up front, but only used as
+// the stack grows into it.
+constexpr size_t STACK_MAX = size_t{1} << 26;
 
 enum struct InterpretResult { OK, COMPILE_ERROR, RUNTIME_ERROR };
 enum struct InterpretMode { FILE, INTERACTIVE };
-
-using Stack = typename std::vector<Value, GCAllocator<Value>>;
-
-struct CallFrame {
-    CallFrame(heap_ptr<ObjClosure> closure, CodeVec::const_iterator ip,
-              size_t slots);
-    Chunk &chunk();
-
-    heap_ptr<ObjClosure> closure;
-    CodeVec::const_iterator ip;
-    const size_t slots;
-};
+/** Which bytecode runs: the compiler's stack code, or register code
+ * translated from it.
+ */
+enum struct ExecutionTier { STACK, REGISTER };
 
 struct VM {
-    VM(InterpretMode interpret_mode);
+    VM(InterpretMode interpret_mode,
+       ExecutionTier tier = ExecutionTier::STACK);
+    /** Writes the opcode stats to `$LOX_OPCODE_STATS`, if they are counted
+     * and it is set.
+     */
+    ~VM();
 
     InterpretResult run_script(heap_ptr<ObjFunction> main);
     InterpretResult run();
+    InterpretResult run_registers();
 
-    void push(const Value &value);
+    void push(const Value &value) { *stack_top++ = value; }
     template <typename... Args>
     void emplace(Args &&...args) {
-        stack.emplace_back(args...);
+        *stack_top++ = Value(std::forward<Args>(args)...);
     }
-    Value pop();
-    Value peek(int distance = 0) const;
+    Value pop() { return *--stack_top; }
+    Value peek(int distance = 0) const { return stack_top[-1 - distance]; }
 
     HeapManager &get_heap_manager();
+    Globals &get_globals();
+    const FrameStack &get_frames() const;
     InterpretMode interpret_mode() const;
+    /** Calls deeper than `max_frames` are a stack overflow. */
+    void set_max_frames(size_t max_frames);
 
   private:
     void reset_stack();
@@ -60,15 +74,17 @@ struct VM {
         return *(frame->ip++);
     }
     jump_off_t read_jump(CallFrame *frame);
+    global_ref_t read_global(CallFrame *frame);
+    wide_ref_t read_wide(CallFrame *frame);
     Value read_constant(CallFrame *frame);
-    heap_ptr<ObjString> read_string(CallFrame *frame);
 
     template <typename T, template <typename S> typename FT>
     void binary_func() {
         T b = static_cast<T>(pop());
         T a = static_cast<T>(pop());
         if constexpr (std::is_same_v<T, heap_ptr<ObjString>>) {
-            emplace(heap_manager.initialize(FT<std::string>{}(*a, *b)));
+            // `+` is the only binary operator on strings.
+            emplace(heap_manager.concatenate(a, b));
         } else {
             emplace(FT{}(a, b));
         }
@@ -78,49 +94,86 @@ struct VM {
     /** Define all natives from the natives list.*/
     void define_all_natives();
 
+    /** Fast path of `call_value` for what nearly every register call site
+     * does: call a translated closure with the right number of arguments.
+     * Returns false if the slow path must be taken, which also reports
+     * errors.
+     */
+    bool fast_call_registers(const Value &callee, int arg_count);
     bool call_value(const Value &callee, int arg_count);
     bool call(heap_ptr<ObjClosure> closure, int arg_count);
+    bool call_registers(heap_ptr<ObjClosure> closure, int arg_count);
     bool call_native(heap_ptr<ObjNative> native_fn, int arg_count);
+    /** Replace the current frame with a call to `callee`, whose arguments are
+     * on top of the stack. Returns false, without reporting anything, if the
+     * call must be made as a normal call instead (e.g. to a native, or to
+     * report an error).
+     */
+    bool tail_call(const Value &callee, int arg_count);
+    bool tail_call_registers(const Value &callee, int arg_count);
+    /** Translate `function` to register code, unless it already is. Returns
+     * false if it can't be translated.
+     */
+    bool translate(heap_ptr<ObjFunction> function);
+    /** Translate `function` and every function nested in it. Returns false
+     * if any of them can't be translated.
+     */
+    bool translate_all(heap_ptr<ObjFunction> function);
 
-    heap_ptr<ObjUpvalue> capture_upvalue(size_t stack_index);
+    /** Push a closure of `function`, capturing the upvalues listed after the
+     * CLOSURE instruction that `frame` is executing.
+     */
+    void push_closure(CallFrame *frame, heap_ptr<ObjFunction> function);
+    heap_ptr<ObjUpvalue> capture_upvalue(Value *local);
     /**
-     * @brief Close all upvalues pointing to stack indices that are >=
-     * `last_index`.
+     * @brief Close all upvalues pointing to stack slots that are >= `last`.
      */
-    void close_upvalues(size_t last_index);
+    void close_upvalues(Value *last);
 
-    void mark_globals();
-    void mark_roots();
+    /** Mark the roots, except the stack. Only marks the global slots written
+     * since globals were last marked if `dirty_globals_only`.
+     */
+    void mark_globals(gc::GrayStack &gray, bool dirty_globals_only);
+    void mark_roots(gc::GrayStack &gray, bool dirty_globals_only);
     // Garbage collector
     void collect_garbage();
 
     template <typename... Args>
     void runtime_error(fmt::format_string<Args...> fmt, Args &&...args) {
         std::cerr << fmt::format(fmt, std::forward<Args>(args)...) << '\n';
-
-        for (const auto &frame : std::ranges::reverse_view(frames)) {
-            auto function = frame.closure->function;
-            size_t instruction = frame.ip - function->chunk.code.begin() - 1;
-            std::cerr << fmt::format("[line {}] in ",
-                                     function->chunk.get_line(instruction));
-            if (function->name == nullptr) {
-                std::cerr << "script\n";
-            } else {
-                std::cerr << fmt::format("{}()\n", function->name->str());
-            }
-        }
+        print_stack_trace();
         reset_stack();
         frames.clear();
     };
+    /** Print the frames, innermost first. Only the frames at either end of a
+     * deep stack are printed.
+     */
+    void print_stack_trace();
 
     void print_stack() const;
+    void print_registers(const CallFrame &frame) const;
 
     HeapManager heap_manager;
-    VariableMap globals;
-    Stack stack;
+    Globals globals;
+    struct UnmapStack {
+        void operator()(Value *stack) const;
+    };
+
+    // The stack never reallocates, so frames and open upvalues can point into
+    // it.
+    std::unique_ptr<Value[], UnmapStack> stack;
+    Value *stack_top;
     InterpretMode m_interpret_mode;
+    ExecutionTier tier;
+    // Whether the running script is on the stack tier, since the register
+    // tier couldn't translate it.
+    bool stack_fallback = false;
     std::forward_list<heap_ptr<ObjUpvalue>> open_upvalues;
-    std::vector<CallFrame> frames;
+    FrameStack frames;
+    // Only if `DEBUG_COUNT_OPCODES`.
+    std::unique_ptr<OpcodeStats> opcode_stats;
 };
 
+/** Compile `source` for `vm`, without running it. */
+std::optional<heap_ptr<ObjFunction>> compile(VM &vm, const std::string &source);
 InterpretResult interpret(VM &vm, const std::string &source);
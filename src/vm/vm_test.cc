@@ -0,0 +1,220 @@
+#include <gtest/gtest.h>
+
+#include "src/vm/vm.h"
+
+#include <string>
+
+namespace {
+
+/** A script adding up `count` distinct constants, so that most of them need a
+ * wide operand. Calls an undefined function if the sum is wrong.
+ */
+std::string many_constants_script(int count) {
+    std::string source = "fun f() {\n  var s = 0;\n";
+    for (int n = 1; n <= count; ++n) {
+        source += "  s = s + " + std::to_string(n) + ";\n";
+    }
+    long long sum = static_cast<long long>(count) * (count + 1) / 2;
+    source += "  return s;\n}\n";
+    source += "if (f() != " + std::to_string(sum) + ") fail();\n";
+    return source;
+}
+
+/** A script with a loop whose body is longer than a compact jump can skip. */
+std::string long_loop_script(int statements) {
+    std::string source = "fun f() {\n  var s = 0;\n"
+                         "  for (var i = 0; i < 2; i = i + 1) {\n";
+    for (int n = 0; n < statements; ++n) {
+        source += "    if (i >= 0) s = s + 1;\n";
+    }
+    source += "  }\n  return s;\n}\n";
+    source += "if (f() != " + std::to_string(2 * statements) + ") fail();\n";
+    return source;
+}
+
+/** A script nesting `depth` calls, each the last of 254 arguments, so that
+ * the arguments need more registers than a register frame has.
+ */
+std::string nested_calls_script(int depth) {
+    std::string parameters = "p0";
+    std::string arguments;
+    for (int n = 1; n < 254; ++n) {
+        parameters += ", p" + std::to_string(n);
+        arguments += "a, ";
+    }
+    std::string call = "f(" + arguments + "a)";
+    for (int n = 0; n < depth; ++n) {
+        call = "f(" + arguments + call + ")";
+    }
+    return "var a = 1;\n"
+           "fun f(" +
+           parameters + ") { return p253 + 1; }\n"
+           "fun g() { return " +
+           call + "; }\n"
+           "if (" +
+           call + " != " + std::to_string(depth + 2) +
+           ") fail();\n"
+           "if (g() != " +
+           std::to_string(depth + 2) + ") fail();\n";
+}
+
+} // namespace
+
+class WideOperandTests : public testing::TestWithParam<ExecutionTier> {};
+
+TEST_P(WideOperandTests, TestManyConstants) {
+    VM vm{InterpretMode::FILE, GetParam()};
+    // Past the register tier's RK operands too.
+    EXPECT_EQ(interpret(vm, many_constants_script(100000)),
+              InterpretResult::OK);
+}
+
+TEST_P(WideOperandTests, TestLongJumps) {
+    VM vm{InterpretMode::FILE, GetParam()};
+    // A loop body of over 1MB of bytecode.
+    EXPECT_EQ(interpret(vm, long_loop_script(60000)), InterpretResult::OK);
+}
+
+INSTANTIATE_TEST_SUITE_P(VMTests, WideOperandTests,
+                         testing::Values(ExecutionTier::STACK,
+                                         ExecutionTier::REGISTER));
+
+class RopeTests : public testing::TestWithParam<ExecutionTier> {};
+
+TEST_P(RopeTests, TestRopesEqualFlatStrings) {
+    std::string literal = "\"" + std::string(300, 'a') + "\"";
+    VM vm{InterpretMode::FILE, GetParam()};
+    EXPECT_EQ(interpret(vm, R"(
+        var s = "";
+        var t = "";
+        for (var i = 0; i < 300; i = i + 1) {
+            s = s + "a";
+            t = "a" + t;
+        }
+        if (s != t) fail();
+        if (s != )" + literal + R"() fail();
+        if (s == t + "a") fail();
+        if (s + "b" == t + "c") fail();
+        if (s + "b" != )" + literal + R"( + "b") fail();
+    )"),
+              InterpretResult::OK);
+}
+
+TEST_P(RopeTests, TestRopesOnlyAccountForTheirBuffersOnceFlattened) {
+    VM vm{InterpretMode::FILE, GetParam()};
+    ASSERT_EQ(interpret(vm, R"(
+        var s = "";
+        for (var i = 0; i < 20000; i = i + 1) {
+            s = s + "a";
+        }
+    )"),
+              InterpretResult::OK);
+    const Heap &heap = vm.get_heap_manager().get_heap();
+    // Not the length of every intermediate rope.
+    EXPECT_LT(heap.get_bytes_allocated(), 20000 * 200);
+
+    // Comparing flattens both ropes.
+    ASSERT_EQ(interpret(vm, R"(
+        var t = s + "b";
+        var u = s + "b";
+        if (t != u) fail();
+    )"),
+              InterpretResult::OK);
+    EXPECT_GT(heap.get_bytes_allocated(), 2 * 20000);
+}
+
+INSTANTIATE_TEST_SUITE_P(VMTests, RopeTests,
+                         testing::Values(ExecutionTier::STACK,
+                                         ExecutionTier::REGISTER));
+
+class TailCallTests : public testing::TestWithParam<ExecutionTier> {};
+
+TEST_P(TailCallTests, TestTailRecursionDoesNotOverflow) {
+    VM vm{InterpretMode::FILE, GetParam()};
+    EXPECT_EQ(interpret(vm, R"(
+        fun count(n, acc) {
+            if (n == 0) return acc;
+            return count(n - 1, acc + 1);
+        }
+        if (count(100000, 0) != 100000) fail();
+
+        fun is_even(n) { if (n == 0) return true; return is_odd(n - 1); }
+        fun is_odd(n) { if (n == 0) return false; return is_even(n - 1); }
+        if (!is_even(10000)) fail();
+
+        fun now() { return clock(); }
+        if (now() < 0) fail();
+    )"),
+              InterpretResult::OK);
+}
+
+TEST_P(TailCallTests, TestTailCallClosesUpvalues) {
+    VM vm{InterpretMode::FILE, GetParam()};
+    EXPECT_EQ(interpret(vm, R"(
+        // Returns the closures made by the first and the last call.
+        fun chain(n, first, last) {
+            if (n == 0) return first() * 10000 + last();
+            var captured = n;
+            fun read() { return captured; }
+            if (first == nil) first = read;
+            return chain(n - 1, first, read);
+        }
+        if (chain(1000, nil, nil) != 10000001) fail();
+    )"),
+              InterpretResult::OK);
+}
+
+INSTANTIATE_TEST_SUITE_P(VMTests, TailCallTests,
+                         testing::Values(ExecutionTier::STACK,
+                                         ExecutionTier::REGISTER));
+
+class DeepRecursionTests : public testing::TestWithParam<ExecutionTier> {};
+
+TEST_P(DeepRecursionTests, TestDeepRecursion) {
+    VM vm{InterpretMode::FILE, GetParam()};
+    EXPECT_EQ(interpret(vm, R"(
+        fun depth(n) {
+            if (n == 0) return 0;
+            return depth(n - 1) + 1;
+        }
+        if (depth(200000) != 200000) fail();
+        // The frames are reused after returning.
+        if (depth(200000) != 200000) fail();
+    )"),
+              InterpretResult::OK);
+}
+
+TEST_P(DeepRecursionTests, TestMaxFrames) {
+    std::string source = R"(
+        fun depth(n) {
+            if (n == 0) return 0;
+            return depth(n - 1) + 1;
+        }
+        depth(5000);
+    )";
+    VM vm{InterpretMode::FILE, GetParam()};
+    vm.set_max_frames(5000);
+    EXPECT_EQ(interpret(vm, source), InterpretResult::RUNTIME_ERROR);
+    vm.set_max_frames(5002);
+    EXPECT_EQ(interpret(vm, source), InterpretResult::OK);
+}
+
+INSTANTIATE_TEST_SUITE_P(VMTests, DeepRecursionTests,
+                         testing::Values(ExecutionTier::STACK,
+                                         ExecutionTier::REGISTER));
+
+class TierFallbackTests : public testing::TestWithParam<ExecutionTier> {};
+
+TEST_P(TierFallbackTests, TestUntranslatableScriptRuns) {
+    VM vm{InterpretMode::FILE, GetParam()};
+    // The register tier can't translate it, so it runs on the stack tier.
+    EXPECT_EQ(interpret(vm, nested_calls_script(140)),
+              InterpretResult::OK);
+    // And the next script is back on the tier it was given.
+    EXPECT_EQ(interpret(vm, "if (a + (a + a) != 3) fail();"),
+              InterpretResult::OK);
+}
+
+INSTANTIATE_TEST_SUITE_P(VMTests, TierFallbackTests,
+                         testing::Values(ExecutionTier::STACK,
+                                         ExecutionTier::REGISTER));